@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -16,76 +16,386 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
 
+#define NHASH   4096   // hash chains
+#define NBUCKET 61     // locks, each covering every NBUCKETth chain
+#define NSAMPLE 8      // unused buffers to compare when recycling
+
+// A page of buffers, allocated when the cache grows.
+#define BPERPAGE ((PGSIZE - sizeof(void*)) / sizeof(struct buf))
+struct bpage {
+  struct bpage *next;
+  struct buf buf[BPERPAGE];
+};
+
+// Buffers are kept on hash chains keyed by (dev, blockno).
+// The chains are guarded by NBUCKET bucket locks, so that
+// lookups of different blocks rarely contend.
+//
+// The cache starts with the NBUF static buffers and grows a
+// page of buffers at a time, out of kalloc(), until it holds
+// maxbuf; after that a miss recycles an unused buffer. The
+// recycled buffer is the least recently released of the
+// first NSAMPLE unused ones found by a hand sweeping the
+// chains, which approximates LRU without looking at every
+// buffer. When kalloc() runs out of memory it calls
+// bshrink() to give back pages whose buffers are all unused.
+//
+// bcache.lock serializes growing, recycling and shrinking,
+// and guards the free list and the page list. A bucket lock
+// guards its chains and the dev, blockno and refcnt of the
+// buffers on them. Only a hart holding bcache.lock takes
+// two bucket locks at once.
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct buf *free;          // buffers on no chain, through b->next
+  struct bpage *pages;       // pages allocated for buffers
+  uint nbuf;                 // buffers in the cache
+  uint maxbuf;               // most it may grow to
+  uint hand;                 // next chain for recycling to look at
+  struct spinlock bucket[NBUCKET];
+  struct buf *hash[NHASH];   // chains, through b->next
 } bcache;
 
+// Hits and misses, counted per hart so that harts don't
+// share a cache line; kept in a line of their own.
+struct {
+  uint64 hit;
+  uint64 miss;
+  uint64 ra;       // blocks read ahead
+  char pad[40];
+} bstat[NCPU];
+
+static void bput(struct buf *b);
+
+static uint
+hashof(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NHASH;
+}
+
+static struct spinlock*
+lockof(uint h)
+{
+  return &bcache.bucket[h % NBUCKET];
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i], "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    initsleeplockquiet(&b->lock, "buffer");
+    b->next = bcache.free;
+    bcache.free = b;
   }
+  bcache.nbuf = NBUF;
+  bcache.maxbuf = NBUF +
+    (PHYSTOP - KERNBASE) / PGSIZE * BCACHEPCT / 100 * BPERPAGE;
+}
+
+// Find the buffer for block blockno of dev on chain h.
+// Caller must hold lockof(h).
+static struct buf*
+bfind(uint h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.hash[h]; b != 0; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Remove b from the list at *head.
+static void
+bunlink(struct buf **head, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = head; *pp != b; pp = &(*pp)->next)
+    ;
+  *pp = b->next;
+  b->next = 0;
+}
+
+// Add a page of buffers to the free list, if the cache is
+// below its limit and there is memory.
+// Caller must not hold bcache.lock, since kalloc() may
+// call bshrink().
+static void
+bgrow(void)
+{
+  struct bpage *pg;
+  struct buf *b;
+
+  if((pg = (struct bpage*)kalloc()) == 0)
+    return;
+  memset(pg, 0, sizeof(*pg));
+  for(b = pg->buf; b < pg->buf+BPERPAGE; b++)
+    initsleeplockquiet(&b->lock, "buffer");
+
+  acquire(&bcache.lock);
+  if(bcache.nbuf + BPERPAGE > bcache.maxbuf){
+    // another hart grew it first.
+    release(&bcache.lock);
+    kfree(pg);
+    return;
+  }
+  for(b = pg->buf; b < pg->buf+BPERPAGE; b++){
+    b->next = bcache.free;
+    bcache.free = b;
+  }
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.nbuf += BPERPAGE;
+  release(&bcache.lock);
+}
+
+// Take the least recently released of the first NSAMPLE
+// unused buffers after the hand off its chain.
+// Caller must hold bcache.lock.
+static struct buf*
+brecycle(void)
+{
+  struct spinlock *lk, *vlk = 0;
+  struct buf *b, *victim = 0;
+  uint h = 0, vh = 0;
+  int i, nseen = 0;
+
+  for(i = 0; i < NHASH && nseen < NSAMPLE; i++){
+    h = (bcache.hand + i) % NHASH;
+    lk = lockof(h);
+    // the victim's lock is held already.
+    if(lk != vlk)
+      acquire(lk);
+    for(b = bcache.hash[h]; b != 0; b = b->next){
+      if(b->refcnt != 0)
+        continue;
+      nseen++;
+      if(victim == 0 || b->lastuse < victim->lastuse){
+        if(vlk != 0 && vlk != lk)
+          release(vlk);
+        victim = b;
+        vh = h;
+        vlk = lk;
+      }
+    }
+    if(lk != vlk)
+      release(lk);
+  }
+  bcache.hand = (h + 1) % NHASH;
+  if(victim == 0)
+    return 0;
+  bunlink(&bcache.hash[vh], victim);
+  release(vlk);
+  return victim;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead (ra set), return 0 if the block is cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ra)
 {
+  uint h = hashof(dev, blockno);
+  struct spinlock *lk = lockof(h);
   struct buf *b;
+  int grown = 0;
 
-  acquire(&bcache.lock);
+  acquire(lk);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+  if((b = bfind(h, dev, blockno)) != 0){
+    if(ra){
+      release(lk);
+      return 0;
+    }
+    b->refcnt++;
+    bstat[cpuid()].hit++;
+    release(lk);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  if(ra)
+    bstat[cpuid()].ra++;
+  else
+    bstat[cpuid()].miss++;
+  release(lk);
+
+  // Not cached. Only one hart recycles at a time, so
+  // once the block is known to be missing it stays missing
+  // until this hart adds it.
+  acquire(&bcache.lock);
+  for(;;){
+    acquire(lk);
+    if((b = bfind(h, dev, blockno)) != 0){
+      if(ra){
+        release(lk);
+        release(&bcache.lock);
+        return 0;
+      }
       b->refcnt++;
+      release(lk);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
+    release(lk);
+    if(bcache.free != 0 || grown || bcache.nbuf + BPERPAGE > bcache.maxbuf)
+      break;
+    // grow, then look again, since the block may have
+    // been added while bcache.lock was released.
+    release(&bcache.lock);
+    bgrow();
+    grown = 1;
+    acquire(&bcache.lock);
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = bcache.free) != 0)
+    bcache.free = b->next;
+  else if((b = brecycle()) == 0)
+    panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+
+  acquire(lk);
+  b->next = bcache.hash[h];
+  bcache.hash[h] = b;
+  release(lk);
+  release(&bcache.lock);
+
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Take b out of the cache if no one is using it.
+// Returns 0 if it was taken out, -1 if it is in use.
+// Caller must hold bcache.lock.
+static int
+bclaim(struct buf *b)
+{
+  struct buf *f;
+  struct spinlock *lk;
+  uint h;
+
+  for(f = bcache.free; f != 0; f = f->next){
+    if(f == b){
+      bunlink(&bcache.free, b);
+      return 0;
     }
   }
-  panic("bget: no buffers");
+  h = hashof(b->dev, b->blockno);
+  lk = lockof(h);
+  acquire(lk);
+  if(b->refcnt != 0){
+    release(lk);
+    return -1;
+  }
+  bunlink(&bcache.hash[h], b);
+  release(lk);
+  return 0;
+}
+
+// Give up to n pages of unused buffers back to kalloc().
+// Returns the number of pages freed.
+int
+bshrink(int n)
+{
+  struct bpage *pg, **pp;
+  struct buf *b;
+  int i, nfreed = 0;
+  uint claimed;
+
+  acquire(&bcache.lock);
+  pp = &bcache.pages;
+  while((pg = *pp) != 0 && nfreed < n){
+    claimed = 0;
+    for(i = 0; i < BPERPAGE; i++)
+      if(bclaim(&pg->buf[i]) == 0)
+        claimed |= 1 << i;
+    if(claimed != (1 << BPERPAGE) - 1){
+      // some buffer is in use; keep the page, and put
+      // the buffers taken out on the free list.
+      for(i = 0; i < BPERPAGE; i++){
+        if(claimed & (1 << i)){
+          b = &pg->buf[i];
+          b->next = bcache.free;
+          bcache.free = b;
+        }
+      }
+      pp = &pg->next;
+      continue;
+    }
+    *pp = pg->next;
+    bcache.nbuf -= BPERPAGE;
+    kfree(pg);
+    nfreed++;
+  }
+  release(&bcache.lock);
+  return nfreed;
+}
+
+// Take every unused buffer out of the cache, so that the
+// blocks are read from disk again. Returns how many were
+// dropped.
+int
+bdrop(void)
+{
+  struct buf *b, **pp;
+  int h, n = 0;
+
+  acquire(&bcache.lock);
+  for(h = 0; h < NHASH; h++){
+    acquire(lockof(h));
+    pp = &bcache.hash[h];
+    while((b = *pp) != 0){
+      if(b->refcnt != 0){
+        pp = &b->next;
+        continue;
+      }
+      *pp = b->next;
+      b->next = bcache.free;
+      bcache.free = b;
+      n++;
+    }
+    release(lockof(h));
+  }
+  release(&bcache.lock);
+  return n;
+}
+
+// Add the cache's statistics to *info.
+void
+bcachestat(struct sysinfo *info)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++){
+    info->bhit += bstat[i].hit;
+    info->bmiss += bstat[i].miss;
+    info->bra += bstat[i].ra;
+  }
+  info->nbuf = bcache.nbuf;
+  info->maxbuf = bcache.maxbuf;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,25 +404,138 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    iosched_submit(b, b->blockno, 0, 0);
+    iosched_wait(b);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, without
+// reading it from the disk if it isn't cached. For a caller
+// that is about to overwrite the whole block.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->valid = 1;
+  return b;
+}
+
+// Queue transfers for the n locked bufs in b[] together,
+// so that the I/O scheduler sorts and merges them as a batch.
+// to[i] is the disk block for b[i], or, if to is 0, b[i]'s own.
+static void
+bsubmit(struct buf **b, uint *to, int n, int write, void (*done)(struct buf *))
+{
+  int i;
+
+  iosched_plug();
+  for(i = 0; i < n; i++)
+    iosched_submit(b[i], to ? to[i] : b[i]->blockno, write, done);
+  iosched_unplug();
+}
+
+// Start reading the n blocks in blockno[] into the cache,
+// except those that are there already, without waiting for
+// the disk. Each buffer stays locked, so that a bread() of
+// the block waits for the read, until the disk driver calls
+// bdone().
+void
+breadav(uint dev, uint *blockno, int n)
+{
+  struct buf *b[RAMAX];
+  int i, m;
+
+  while(n > 0){
+    m = 0;
+    for(i = 0; i < n && i < RAMAX; i++){
+      if((b[m] = bget(dev, blockno[i], 1)) == 0)
+        continue;
+      // someone else may have found the new buffer and read it.
+      if(b[m]->valid)
+        brelse(b[m]);
+      else
+        m++;
+    }
+    blockno += i;
+    n -= i;
+    bsubmit(b, 0, m, 0, bdone);
+  }
+}
+
+// Finish a read started by breadav(). Called by the disk
+// driver's interrupt handler, so it can't use brelse(),
+// which checks that the calling process holds the lock.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
+{
+  bstart(b);
+  bwait(b);
+}
+
+// Start writing b's contents to disk, without waiting.
+// b must be locked, and stay locked until bwait(b).
+// Lets a caller keep many writes in flight at once.
+void
+bstart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bstart");
+  iosched_submit(b, b->blockno, 1, 0);
+}
+
+// Start writing the n locked bufs in b[], as with bstart(),
+// letting the I/O scheduler sort and merge them as a batch.
+void
+bstartv(struct buf **b, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&b[i]->lock))
+      panic("bstartv");
+  bsubmit(b, 0, n, 1, 0);
+}
+
+// Like bstartv(), but write each b[i] to disk block to[i]
+// instead of to its own block. The cache is not changed:
+// a cached copy of to[i] keeps its contents.
+void
+bstartto(struct buf **b, uint *to, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&b[i]->lock))
+      panic("bstartto");
+  bsubmit(b, to, n, 1, 0);
+}
+
+// Wait for a write started by bstart(), bstartv() or bstartto().
+void
+bwait(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
-    panic("bwrite");
-  virtio_disk_rw(b, 1);
+    panic("bwait");
+  iosched_wait(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Record the time, for choosing what to recycle.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +543,40 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
+// Drop a reference to b.
+static void
+bput(struct buf *b)
+{
+  struct spinlock *lk;
+
+  // a buffer with refcnt > 0 does not change chains.
+  lk = lockof(hashof(b->dev, b->blockno));
+  acquire(lk);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = r_time();
   }
-  
-  release(&bcache.lock);
+  release(lk);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct spinlock *lk = lockof(hashof(b->dev, b->blockno));
+
+  acquire(lk);
   b->refcnt++;
-  release(&bcache.lock);
+  release(lk);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct spinlock *lk = lockof(hashof(b->dev, b->blockno));
+
+  acquire(lk);
   b->refcnt--;
-  release(&bcache.lock);
+  release(lk);
 }
-
-
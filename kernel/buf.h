@@ -5,8 +5,13 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint64 lastuse;   // r_time() of the last brelse(), for LRU
+  struct buf *next; // hash bucket list
+  struct buf *qnext; // I/O scheduler queue
+  uint qblock;      // disk block the queued I/O is for, usually blockno
+  int qwrite;       // queued for writing?
+  void (*qdone)(struct buf *); // called when the queued I/O is done
+  uint64 qtime;     // r_time() when queued, for latency
   uchar data[BSIZE];
 };
 
@@ -2,20 +2,34 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iostat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct rwlock;
+struct rwsleeplock;
 struct stat;
 struct superblock;
+struct sysinfo;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bstart(struct buf*);
+void            bstartv(struct buf**, int);
+void            bstartto(struct buf**, uint*, int);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadav(uint, uint*, int);
+void            bdone(struct buf*);
+int             bdrop(void);
+int             bshrink(int);
+void            bcachestat(struct sysinfo*);
 
 // console.c
 void            consoleinit(void);
@@ -44,6 +58,8 @@ void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            ilockshared(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -53,12 +69,23 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            ballocstat(struct sysinfo*);
 
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// iosched.c
+void            iosched_init(void);
+void            iosched_submit(struct buf*, uint, int, void (*)(struct buf*));
+void            iosched_wait(struct buf*);
+void            iosched_plug(void);
+void            iosched_unplug(void);
+void            iosched_kick(void);
+int             iostat(uint64);
+int             iopoll(int, int);
+
 // kalloc.c
 void*           kalloc(void);
 void            krefer(void*);
@@ -68,9 +95,17 @@ void            kinit(void);
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
+void            log_free(uint);
+void            log_sync(void);
 void            begin_op(void);
 void            end_op(void);
 
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, int);
+int             futex_wake(uint64, int);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -86,7 +121,9 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             clone(uint64, uint64, uint64);
+int             join(int);
+uint64          growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -99,10 +136,19 @@ struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             schedtick(void);
+int             setpriority(int, int);
+int             setaffinity(int, int);
+void            tlbshootdown(pagetable_t);
+int             getpstat(int, uint64);
 void            sleep(void*, struct spinlock*);
+void            sleep2(void*, struct spinlock*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void (*)(void));
 int             wait(uint64);
+int             waitpid(int, uint64, int);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -115,15 +161,35 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlockquiet(struct spinlock*, char*);
+void            freelock(struct spinlock*);
+int             lockstat(uint64, int);
+void            recordwait(uint64, char*, int, uint64);
+int             locksites(uint64, int);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// rwlock.c
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+int             holdingwrite(struct rwlock*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initsleeplockquiet(struct sleeplock*, char*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
+void            acquirereadsleep(struct rwsleeplock*);
+void            releasereadsleep(struct rwsleeplock*);
+void            acquirewritesleep(struct rwsleeplock*);
+void            releasewritesleep(struct rwsleeplock*);
+int             holdingwritesleep(struct rwsleeplock*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -148,6 +214,15 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            tickupdate(void);
+void            clockset(void);
+
+// timer.c
+void            wheelinit(void);
+void            wheelrun(void);
+uint64          wheelnext(void);
+int             sleepuntil(uint64);
+void            sleeptimeout(void*, struct spinlock*, uint64);
 
 // uart.c
 void            uartinit(void);
@@ -184,8 +259,10 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_startv(struct buf **, int, int, void (*)(struct buf *), int);
 void            virtio_disk_intr(void);
+void            virtio_disk_poll(void);
+void            virtio_disk_stat(struct iostat*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -31,6 +31,11 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // the other threads would be left running in the
+  // old address space.
+  if(p->leader != p || p->tfslots != 1)
+    return -1;
+
   begin_op();
 
   if((ip = namei(path)) == 0){
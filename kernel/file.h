@@ -18,7 +18,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
+  struct rwsleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
@@ -27,6 +27,12 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  // read-ahead state, see readahead() in fs.c
+  uint ranext;        // block after the last one read
+  uint raend;         // first block not yet read ahead
+  uint rawin;         // read-ahead window, in blocks
+  uint agoal;         // where balloc() should look first; see bmap()
 };
 
 // map major device number to device functions.
@@ -15,17 +15,33 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "sysinfo.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// In-memory summary of the free bitmap, so that balloc() need
+// not read bitmap blocks that have nothing free.
+struct {
+  struct spinlock lock;
+  int nbmap;           // number of bitmap blocks
+  int *nfree;          // free blocks each one marks, or -1 if not counted yet
+  uint last;           // block after the last one allocated
+  uint64 nalloc;       // statistics for sysinfo()
+  uint64 nscan;        // bitmap bits balloc() looked at
+  uint64 nread;        // bitmap blocks balloc() read
+} bsum;
+
+static void initbsum(void);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -43,6 +59,7 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  initbsum();
   initlog(dev, &sb);
 }
 
@@ -54,32 +71,118 @@ bzero(int dev, int bno)
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  log_data(bp);  // logged if it becomes metadata
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+static void
+initbsum(void)
+{
+  int i;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap * sizeof(int) > PGSIZE)
+    panic("initbsum: bitmap too big");
+  if((bsum.nfree = (int*)kalloc()) == 0)
+    panic("initbsum: kalloc");
+  for(i = 0; i < bsum.nbmap; i++)
+    bsum.nfree[i] = -1;
+}
+
+// Look for a free block in bitmap block bp, which covers blocks
+// b to b+BPB-1, starting at bit start and wrapping around.
+// Returns its bit, or -1; *scan is how many bits it looked at.
+static int
+bfind(struct buf *bp, uint b, int start, int *scan)
+{
+  int bi, k, lim;
+
+  lim = sb.size - b < BPB ? sb.size - b : BPB;
+  for(k = 0; k < lim; k++){
+    bi = (start + k) % lim;
+    if(bi % 8 == 0 && bi + 8 <= lim && bp->data[bi/8] == 0xff){
+      k += 7;  // skip a full byte
+      continue;
+    }
+    if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+      *scan = k + 1;
+      return bi;
+    }
+  }
+  *scan = lim;
+  return -1;
+}
+
+// Count the free blocks that bitmap block bp, covering
+// blocks b to b+BPB-1, marks.
+static int
+bcount(struct buf *bp, uint b)
+{
+  int bi, n;
+
+  n = 0;
+  for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+    if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+      n++;
+  return n;
+}
+
+// Allocate a disk block, near goal if goal isn't 0, and zero
+// it unless zero is 0, when the caller must overwrite it all.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal, int zero)
 {
-  int b, bi, m;
+  int i, n, bi, scan;
+  uint b;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  acquire(&bsum.lock);
+  if(goal == 0)
+    goal = bsum.last;
+  release(&bsum.lock);
+  if(goal >= sb.size)
+    goal = 0;
+
+  for(i = 0; i < bsum.nbmap; i++){
+    n = (goal / BPB + i) % bsum.nbmap;
+    b = n * BPB;
+    acquire(&bsum.lock);
+    if(bsum.nfree[n] == 0){  // nothing free here
+      release(&bsum.lock);
+      continue;
+    }
+    bsum.nread++;
+    release(&bsum.lock);
+
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
+    bi = bfind(bp, b, i == 0 ? goal % BPB : 0, &scan);
+    acquire(&bsum.lock);
+    // the count changes only with the bitmap block locked.
+    if(bsum.nfree[n] < 0)
+      bsum.nfree[n] = bcount(bp, b);
+    bsum.nscan += scan;
+    if(bi >= 0){
+      bsum.nfree[n]--;
+      bsum.nalloc++;
+      bsum.last = b + bi + 1;
+    }
+    release(&bsum.lock);
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      if(zero){
         bzero(dev, b + bi);
-        return b + bi;
+      } else {
+        // cache it, so the caller's bread() doesn't read the disk.
+        bp = bnew(dev, b + bi);
+        brelse(bp);
       }
+      return b + bi;
     }
     brelse(bp);
   }
@@ -100,8 +203,24 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  acquire(&bsum.lock);
+  if(bsum.nfree[b / BPB] >= 0)
+    bsum.nfree[b / BPB]++;
+  release(&bsum.lock);
   log_write(bp);
   brelse(bp);
+  log_free(b);
+}
+
+// Add the block allocator's statistics to *info.
+void
+ballocstat(struct sysinfo *info)
+{
+  acquire(&bsum.lock);
+  info->balloc = bsum.nalloc;
+  info->bscan = bsum.nscan;
+  info->bscanread = bsum.nread;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -164,17 +283,23 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// The itable.lock reader-writer lock protects the allocation of
+// itable entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
+// Holding it for reading is enough to look entries up and to
+// change ip->ref with atomic instructions, as long as ref does
+// not reach zero for an inode that must be freed on disk;
+// recycling an entry takes it for writing.
 //
-// An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// An ip->lock reader-writer sleep-lock protects all ip-> fields
+// other than ref, dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// ilockshared() takes it for reading, so that path lookups through
+// the same directories don't serialize.
 
 struct {
-  struct spinlock lock;
+  struct rwlock lock;
   struct inode inode[NINODE];
 } itable;
 
@@ -183,9 +308,9 @@ iinit()
 {
   int i = 0;
   
-  initlock(&itable.lock, "itable");
+  initrwlock(&itable.lock, "itable");
   for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+    initrwsleeplock(&itable.inode[i].lock, "inode");
   }
 }
 
@@ -248,14 +373,26 @@ iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&itable.lock);
+  // Is the inode already in the table? Entries can't be
+  // recycled while the read lock is held; one whose ref
+  // drops to zero under us keeps its dev and inum.
+  acquireread(&itable.lock);
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+      __sync_fetch_and_add(&ip->ref, 1);
+      releaseread(&itable.lock);
+      return ip;
+    }
+  }
+  releaseread(&itable.lock);
 
-  // Is the inode already in the table?
+  // Look again, since another hart may have added it.
+  acquirewrite(&itable.lock);
   empty = 0;
   for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&itable.lock);
+      releasewrite(&itable.lock);
       return ip;
     }
     if(empty == 0 && ip->ref == 0)    // Remember empty slot.
@@ -271,7 +408,7 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&itable.lock);
+  releasewrite(&itable.lock);
 
   return ip;
 }
@@ -281,9 +418,9 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
-  ip->ref++;
-  release(&itable.lock);
+  acquireread(&itable.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
+  releaseread(&itable.lock);
   return ip;
 }
 
@@ -298,7 +435,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquirewritesleep(&ip->lock);
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -310,6 +447,10 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->ranext = 0;
+    ip->raend = 0;
+    ip->rawin = 0;
+    ip->agoal = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -320,10 +461,38 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingwritesleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releasewritesleep(&ip->lock);
+}
+
+// Lock the given inode for reading only: other readers
+// may hold it too, and the caller must not modify ip or
+// its contents.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  // valid can't be cleared while we hold a reference,
+  // so once ilock() has read the inode it stays read.
+  if(ip->valid == 0){
+    ilock(ip);
+    iunlock(ip);
+  }
+  acquirereadsleep(&ip->lock);
+}
+
+// Unlock an inode locked with ilockshared().
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasereadsleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -336,29 +505,46 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  int ref;
+
+  // Usually just drop the reference. The compare-and-swap
+  // makes sure that of two racing iput()s, the one that
+  // would drop the last reference sees ref == 1.
+  acquireread(&itable.lock);
+  for(;;){
+    ref = ip->ref;
+    if(ref == 1 && ip->valid && ip->nlink == 0)
+      break;
+    if(__sync_bool_compare_and_swap(&ip->ref, ref, ref - 1)){
+      releaseread(&itable.lock);
+      return;
+    }
+  }
+  releaseread(&itable.lock);
+
+  acquirewrite(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
     // ip->ref == 1 means no other process can have ip locked,
-    // so this acquiresleep() won't block (or deadlock).
-    acquiresleep(&ip->lock);
+    // so this acquirewritesleep() won't block (or deadlock).
+    acquirewritesleep(&ip->lock);
 
-    release(&itable.lock);
+    releasewrite(&itable.lock);
 
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
-    releasesleep(&ip->lock);
+    releasewritesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquirewrite(&itable.lock);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  releasewrite(&itable.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -377,20 +563,22 @@ iunlockput(struct inode *ip)
 // listed in block ip->addrs[NDIRECT].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, near the
+// last block allocated to ip, and zeroes it if zero is set.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int zero)
 {
   uint addr, *a;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->agoal, zero);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
+      ip->agoal = addr + 1;
     }
     return addr;
   }
@@ -399,18 +587,20 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->agoal, 1);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
+      ip->agoal = addr + 1;
     }
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, ip->agoal, zero);
       if(addr){
         a[bn] = addr;
         log_write(bp);
+        ip->agoal = addr + 1;
       }
     }
     brelse(bp);
@@ -464,6 +654,48 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Called by readi() as it reads block bn of ip. If the
+// reads of ip are sequential, start reading the blocks
+// that follow before they are asked for. The window grows
+// from RAMIN to RAMAX blocks while the reads stay
+// sequential, and a jump elsewhere closes it. New blocks
+// are requested when the reader is half way through the
+// ones already requested, so that requests go out in
+// batches. ip may be locked shared, so these updates can
+// race; that only makes the guess worse.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, end, nblocks, n, addr[RAMAX];
+
+  if(bn + 1 == ip->ranext)
+    return;  // another read of the same block
+  if(bn == ip->ranext){
+    if(ip->rawin == 0)
+      ip->rawin = RAMIN;
+    else if(ip->rawin < RAMAX)
+      ip->rawin *= 2;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = bn + 1;
+  if(ip->rawin == 0 || ip->raend >= bn + 1 + ip->rawin/2)
+    return;
+
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  end = bn + 1 + ip->rawin;
+  if(end > nblocks)
+    end = nblocks;
+  b = ip->raend > bn + 1 ? ip->raend : bn + 1;
+  for(n = 0; b < end; b++, n++){
+    if((addr[n] = bmap(ip, b, 1)) == 0)
+      break;
+  }
+  breadav(ip->dev, addr, n);
+  ip->raend = b;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -480,7 +712,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, 1);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
@@ -491,6 +723,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
       break;
     }
     brelse(bp);
+    readahead(ip, off/BSIZE);
   }
   return tot;
 }
@@ -514,16 +747,29 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    // a new block needn't be zeroed if all of it is written.
+    uint addr = bmap(ip, off/BSIZE, m < BSIZE);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      if(m == BSIZE && off >= ip->size){
+        // the block may be new and not zeroed, holding some
+        // other block's old contents; zero it after all.
+        memset(bp->data, 0, BSIZE);
+        if(ip->type == T_DIR)
+          log_write(bp);
+        else
+          log_data(bp);
+      }
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ip->type == T_DIR)
+      log_write(bp);
+    else
+      log_data(bp);
     brelse(bp);
   }
 
@@ -652,28 +898,35 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct proc *p = myproc()->leader;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    acquire(&p->tlock);  // chdir() in another thread may change cwd
+    ip = idup(p->cwd);
+    release(&p->tlock);
+  }
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // lookups only read the directory, so they can
+    // share it with each other.
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
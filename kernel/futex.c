@@ -0,0 +1,125 @@
+// Futexes: blocking for user-space locks.
+//
+// futex_wait(addr, val) sleeps if the user word at addr
+// still holds val; futex_wake(addr, n) wakes up to n
+// processes waiting on it. A user-space mutex spins or
+// takes its fast path with atomic instructions, and only
+// calls into the kernel when it must block or when there
+// may be waiters to wake.
+//
+// A futex is named by the physical address of the word,
+// so that the threads of a process and processes sharing
+// a page agree on it. The waiters sleep() with that
+// address as the channel, which puts them on one of the
+// kernel's hashed wait queues. A lock per hash bucket
+// makes the check of the word and the sleep atomic with
+// respect to futex_wake(), so a wakeup cannot fall between
+// them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 31
+
+static struct spinlock futexlock[NFUTEX];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEX; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+static struct spinlock*
+futexlockof(uint64 pa)
+{
+  return &futexlock[(pa >> 2) % NFUTEX];
+}
+
+// Return the physical address of the aligned user word at
+// va, or 0 if it is not mapped writable. A copy-on-write
+// page is copied first: otherwise the first store by any
+// sharer would move the word to a new physical page, away
+// from the futex its waiters are sleeping on.
+// Caller must hold the leader's tlock, so that another
+// thread's sbrk() can't free the page meanwhile.
+static uint64
+futexaddr(uint64 va)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(va % sizeof(int) != 0 || va >= MAXVA)
+    return 0;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if((*pte & PTE_COW) != 0 && uvmcow(p->pagetable, va, 1) < 0)
+    return 0;
+  if((*pte & PTE_W) == 0)
+    return 0;
+  return PTE2PA(*pte) + (va & (PGSIZE-1));
+}
+
+// Sleep until woken by futex_wake(), provided the
+// word at addr holds val. Returns 0 after sleeping, and
+// -1 if the word did not hold val or the process was
+// killed. Like any sleep, it may return early; callers
+// re-check the word.
+int
+futex_wait(uint64 addr, int val)
+{
+  uint64 pa;
+  struct spinlock *lk;
+  struct proc *p = myproc()->leader;
+
+  acquire(&p->tlock);
+  if((pa = futexaddr(addr)) == 0){
+    release(&p->tlock);
+    return -1;
+  }
+  lk = futexlockof(pa);
+  acquire(lk);
+  if(*(volatile int *)pa != val || killed(myproc())){
+    release(lk);
+    release(&p->tlock);
+    return -1;
+  }
+  // the page may be freed once tlock is released, but
+  // sleeping on its address is harmless.
+  release(&p->tlock);
+  sleep((void *)pa, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake up to n processes waiting on the word at addr.
+// Returns how many were woken, or -1.
+int
+futex_wake(uint64 addr, int n)
+{
+  uint64 pa;
+  struct spinlock *lk;
+  int woken;
+  struct proc *p = myproc()->leader;
+
+  if(n <= 0)
+    return -1;
+  acquire(&p->tlock);
+  pa = futexaddr(addr);
+  release(&p->tlock);
+  if(pa == 0)
+    return -1;
+  lk = futexlockof(pa);
+  acquire(lk);
+  woken = wakeupn((void *)pa, n);
+  release(lk);
+  return woken;
+}
@@ -0,0 +1,298 @@
+// I/O scheduler, between the buffer cache and the disk driver.
+//
+// Bufs to be read or written wait in a queue sorted by block
+// number, and go to the disk in one-way elevator (C-SCAN) order:
+// upward from the last block dispatched, then around again from
+// the lowest. A run of consecutive blocks going the same way is
+// merged into a single disk request.
+//
+// The driver has a limited number of descriptors. Blocks it
+// can't take yet stay queued, and are dispatched when earlier
+// requests complete. A caller about to queue a batch, such as
+// a log commit, plugs the queue first, so the whole batch is
+// sorted and merged before any of it goes to the disk.
+//
+// A process waiting for its request can poll the disk for a
+// while before it sleeps, which saves the interrupt and the
+// wakeup when the disk is fast. How long it polls is set per
+// class of request by iopoll(); by default no class polls.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "proc.h"
+#include "iostat.h"
+
+static struct {
+  struct spinlock lock;
+  struct buf *head;    // queued bufs, sorted by block number
+  uint pos;            // the block after the last one dispatched
+  int nqueued;
+  int ninflight;
+  int plugged;         // callers holding the plug
+  int dispatching;     // a hart is in dispatch()
+  int again;           // dispatch() should look at the queue again
+  int poll[NIOCLASS];  // microseconds to poll before sleeping
+  struct iostat stat;
+} ioq;
+
+static void iodone(struct buf *b);
+
+void
+iosched_init(void)
+{
+  initlock(&ioq.lock, "iosched");
+}
+
+static int
+bucket(uint64 v)
+{
+  int i;
+
+  for(i = 0; v > 1 && i < NIOHIST-1; i++)
+    v >>= 1;
+  return i;
+}
+
+// insert b into the queue, after any bufs for the same block.
+// caller must hold ioq.lock.
+static void
+enqueue(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &ioq.head; *pp != 0; pp = &(*pp)->qnext)
+    if((*pp)->qblock > b->qblock)
+      break;
+  b->qnext = *pp;
+  *pp = b;
+  ioq.nqueued++;
+}
+
+// take the next run off the queue: the first buf at or after
+// pos, or the lowest if there is none, and the bufs that follow
+// it on the disk in the same direction. returns its length.
+// caller must hold ioq.lock.
+static int
+nextrun(struct buf **run)
+{
+  struct buf **start, **pp, *b;
+  int n;
+
+  if(ioq.head == 0)
+    return 0;
+  for(start = &ioq.head; *start != 0; start = &(*start)->qnext)
+    if((*start)->qblock >= ioq.pos)
+      break;
+  if(*start == 0)
+    start = &ioq.head;
+
+  run[0] = *start;
+  n = 1;
+  pp = &run[0]->qnext;
+  while(n < MAXSEG && (b = *pp) != 0 && b->qblock <= run[n-1]->qblock + 1){
+    if(b->qblock == run[n-1]->qblock + 1 && b->dev == run[0]->dev &&
+       b->qwrite == run[0]->qwrite){
+      run[n++] = b;
+      *pp = b->qnext;
+    } else {
+      pp = &b->qnext;
+    }
+  }
+  *start = run[0]->qnext;
+  ioq.nqueued -= n;
+  return n;
+}
+
+// hand queued runs to the disk until the queue is empty or
+// the disk can take no more. only one hart dispatches at a
+// time; others ask it to look again.
+static void
+dispatch(void)
+{
+  struct buf *run[MAXSEG];
+  uint pos;
+  int i, n, write;
+
+  acquire(&ioq.lock);
+  if(ioq.plugged || ioq.dispatching){
+    ioq.again = 1;
+    release(&ioq.lock);
+    return;
+  }
+  ioq.dispatching = 1;
+  do {
+    ioq.again = 0;
+    pos = ioq.pos;
+    while((n = nextrun(run)) > 0){
+      write = run[0]->qwrite;
+      ioq.pos = run[n-1]->qblock + 1;
+      ioq.ninflight += n;
+      ioq.stat.nreq[write]++;
+      ioq.stat.nblock[write] += n;
+      ioq.stat.nmerge += n - 1;
+      release(&ioq.lock);
+      if(virtio_disk_startv(run, n, write, iodone, 1) < 0){
+        // the disk is full; try again when a request completes.
+        acquire(&ioq.lock);
+        for(i = 0; i < n; i++)
+          enqueue(run[i]);
+        ioq.ninflight -= n;
+        ioq.stat.nreq[write]--;
+        ioq.stat.nblock[write] -= n;
+        ioq.stat.nmerge -= n - 1;
+        ioq.pos = pos;
+        break;
+      }
+      acquire(&ioq.lock);
+      pos = ioq.pos;
+    }
+  } while(ioq.again && !ioq.plugged);
+  ioq.dispatching = 0;
+  release(&ioq.lock);
+}
+
+// Queue a read or write of the locked buf b, to or from disk
+// block blockno, which is usually b->blockno. When it finishes,
+// done(b) is called from the disk interrupt if done is not 0;
+// otherwise the caller waits with iosched_wait(b).
+void
+iosched_submit(struct buf *b, uint blockno, int write, void (*done)(struct buf *))
+{
+  b->qblock = blockno;
+  b->qwrite = write;
+  b->qdone = done;
+  b->qtime = r_time();
+  b->disk = 1;
+
+  acquire(&ioq.lock);
+  ioq.stat.depth[bucket(ioq.nqueued + ioq.ninflight)]++;
+  enqueue(b);
+  release(&ioq.lock);
+  dispatch();
+}
+
+static void
+record(int mode, int class, uint64 t0)
+{
+  uint64 us = (r_time() - t0) * NSPERCYCLE / 1000;
+
+  ioq.stat.lat[mode][class][bucket(us)]++;
+}
+
+// Wait for a buf queued without a done function.
+void
+iosched_wait(struct buf *b)
+{
+  int class = b->qwrite ? IOC_WRITE : IOC_READ;
+  int mode = IOM_INTR;
+  uint64 end;
+
+  acquire(&ioq.lock);
+  if(b->disk && ioq.poll[class] > 0){
+    end = r_time() + (uint64)ioq.poll[class] * 1000 / NSPERCYCLE;
+    release(&ioq.lock);
+    while(__atomic_load_n(&b->disk, __ATOMIC_ACQUIRE) && r_time() < end)
+      virtio_disk_poll();
+    acquire(&ioq.lock);
+    if(b->disk == 0)
+      mode = IOM_POLL;
+  }
+  while(b->disk)
+    sleep(b, &ioq.lock);
+  record(mode, class, b->qtime);
+  release(&ioq.lock);
+}
+
+// Hold queued bufs back until the matching unplug, so that
+// a batch is sorted and merged as a whole. Must not sleep
+// while plugged.
+void
+iosched_plug(void)
+{
+  acquire(&ioq.lock);
+  ioq.plugged++;
+  release(&ioq.lock);
+}
+
+void
+iosched_unplug(void)
+{
+  acquire(&ioq.lock);
+  if(ioq.plugged < 1)
+    panic("iosched_unplug");
+  ioq.plugged--;
+  release(&ioq.lock);
+  dispatch();
+}
+
+// Start any runs that were waiting for the disk to have room.
+// Called by the disk driver after it completes requests.
+void
+iosched_kick(void)
+{
+  int more;
+
+  acquire(&ioq.lock);
+  more = ioq.head != 0;
+  release(&ioq.lock);
+  if(more)
+    dispatch();
+}
+
+// Called by the disk driver, in its interrupt handler or
+// while polling, for each buf of a completed request.
+static void
+iodone(struct buf *b)
+{
+  void (*done)(struct buf *);
+
+  acquire(&ioq.lock);
+  ioq.ninflight--;
+  done = b->qdone;
+  if(done)
+    record(IOM_INTR, IOC_ASYNC, b->qtime);
+  b->disk = 0;
+  if(done == 0)
+    wakeup(b);
+  release(&ioq.lock);
+  if(done)
+    done(b);
+}
+
+// Set how many microseconds a process waiting for a request
+// of the given class polls the disk before it sleeps.
+// Returns the old setting, or -1 for a class that can't poll.
+int
+iopoll(int class, int us)
+{
+  int old;
+
+  if(class != IOC_READ && class != IOC_WRITE)
+    return -1;
+  if(us < 0)
+    us = 0;
+  acquire(&ioq.lock);
+  old = ioq.poll[class];
+  ioq.poll[class] = us;
+  release(&ioq.lock);
+  return old;
+}
+
+// Copy the statistics to user address addr.
+int
+iostat(uint64 addr)
+{
+  struct iostat st;
+
+  acquire(&ioq.lock);
+  st = ioq.stat;
+  release(&ioq.lock);
+  virtio_disk_stat(&st);
+  return copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st));
+}
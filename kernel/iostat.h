@@ -0,0 +1,29 @@
+// Disk I/O statistics, returned by iostat().
+// Histogram bucket i counts values v with 2^i <= v < 2^(i+1),
+// except that bucket 0 also counts 0.
+#define NIOHIST 16
+
+// Request classes, each with its own polling budget (iopoll())
+// and latency histograms.
+#define IOC_READ   0   // reads a process waits for
+#define IOC_WRITE  1   // writes a process waits for: log commits
+#define IOC_ASYNC  2   // reads no one waits for: read-ahead
+#define NIOCLASS   3
+
+// How the completion of a request was noticed.
+#define IOM_INTR   0   // the disk interrupted, and the waiter woke up
+#define IOM_POLL   1   // the waiter polled the disk
+#define NIOMODE    2
+
+struct iostat {
+  uint64 nreq[2];          // disk requests, reads [0] and writes [1]
+  uint64 nblock[2];        // blocks transferred
+  uint64 nmerge;           // blocks that joined another block's request
+  uint64 depth[NIOHIST];   // blocks queued or in flight when one more arrived
+  uint64 nintr;            // disk interrupts
+  uint64 nidle;            // interrupts with nothing left to complete
+  uint64 nkick;            // times the driver notified the disk
+  // microseconds from queueing a block to its waiter
+  // seeing it done, or to its completion for IOC_ASYNC.
+  uint64 lat[NIOMODE][NIOCLASS][NIOHIST];
+};
@@ -11,6 +11,8 @@
 
 void freerange(void *pa_start, void *pa_end);
 
+#define KSHRINK 16  // buffer cache pages to reclaim when out of memory
+
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
@@ -94,18 +96,26 @@ krefer(void *pa)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, takes pages back from the buffer
+// cache, so it must not be called holding a bcache lock.
 void *
 kalloc(void)
 {
   struct run *r;
-
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r){
-    kmem.freelist = r->next;
-    kmem.ref_count[PA2INDEX(r)] = 1;
+  int shrunk = 0;
+
+  for(;;){
+    acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.ref_count[PA2INDEX(r)] = 1;
+    }
+    release(&kmem.lock);
+    if(r || shrunk || bshrink(KSHRINK) == 0)
+      break;
+    shrunk = 1;
   }
-  release(&kmem.lock);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
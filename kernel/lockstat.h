@@ -0,0 +1,18 @@
+// Spinlock statistics, returned by lockstat().
+struct lockstat {
+  char name[16];
+  uint64 nacquire;   // acquisitions
+  uint64 ncontend;   // acquisitions that had to wait
+  uint64 nspin;      // iterations spent waiting
+  uint64 wait;       // time counter cycles spent waiting
+};
+
+// A place in the kernel that waited for a lock, returned by
+// locksites(). Look pc up in kernel/kernel.asm.
+struct locksite {
+  char name[16];     // the lock's name
+  uint64 pc;         // return address of the acquire call
+  int sleep;         // a sleep lock?
+  uint64 ncontend;   // acquisitions that had to wait
+  uint64 wait;       // time counter cycles spent waiting
+};
@@ -11,30 +11,55 @@
 //
 // A log transaction contains the updates of multiple FS system
 // calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
+// no FS system calls active in the transaction. Thus there is
+// never any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// asks for a commit and sleeps until there is room.
+//
+// Commits are done by a kernel thread, the flusher, so end_op()
+// returns without waiting for the disk. The flusher commits the
+// open transaction COMMITMS after its first update, or sooner
+// if it fills up or fsync() asks; until then, system calls keep
+// adding to it (group commit). Transactions are double-buffered:
+// once a transaction's blocks have been copied out of the cache,
+// the next one opens, and its system calls run while the old one
+// is written to the log and installed.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
+//     and a checksum of the blocks
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The header and the blocks of a commit are written to the disk
+// all at once, rather than one at a time. If the disk only gets
+// some of them, recovery sees the checksum fail and discards
+// the transaction, as if the header had not been written.
+//
+// In ordered mode (the default; make JOURNAL=data logs everything)
+// file data blocks are not logged. log_data() records them, and
+// commit() writes them in place along with the log. The header
+// lists them, and the checksum covers them too, so a committed
+// inode never points at stale data. A
+// block freed by the open transaction is logged even so: written
+// in place, it would change the file that still owns it if the
+// transaction never commits.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  int nd;               // data blocks written in place, on disk only
+  uint sum;             // checksum of the blocks, on disk only
   int block[LOGSIZE];
+  int dblock[LOGSIZE];  // their block #s
 };
 
 struct log {
@@ -42,14 +67,39 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int want;        // a commit has been asked for; please wait.
+  int copying;     // commit() is copying the transaction; please wait.
   int dev;
-  struct logheader lh;
+  uint64 due;      // r_time() by which to commit the open transaction;
+                   // the flusher sleeps on &log.due.
+  uint64 seq;      // number of the open transaction.
+  uint64 done;     // the last transaction that is on disk.
+  struct logheader lh;          // the open transaction.
+  struct buf *buf[LOGSIZE];     // its blocks, pinned in the cache.
+  int ndata;
+  struct buf *dbuf[LOGSIZE];    // its data blocks, pinned, not logged.
+  int nfreed;                   // > LOGSIZE if freed[] overflowed.
+  uint freed[LOGSIZE];          // blocks it freed.
+
+  // the transaction being committed, private to commit().
+  struct logheader clh;
+  struct buf *cbuf[LOGSIZE];    // its blocks, to unpin once installed.
+  struct buf *lbuf[LOGSIZE];    // log blocks holding copies of them.
+  int cndata;
+  struct buf *cdbuf[LOGSIZE];   // its data blocks, to write in place.
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void flusher(void);
+
+// number of blocks in the open transaction.
+static int
+pending(void)
+{
+  return log.lh.n + log.ndata;
+}
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,64 +111,151 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  kthread("flusher", flusher);
 }
 
 // Copy committed blocks from log to their home location
 static void
 install_trans(int recovering)
 {
+  uint home[LOGSIZE];
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  if(recovering == 0){
+    // the copies in lbuf[] are what was committed; the cached
+    // home blocks may hold newer, uncommitted changes.
+    for (tail = 0; tail < log.clh.n; tail++)
+      home[tail] = log.clh.block[tail];
+    bstartto(log.lbuf, home, log.clh.n);  // write copies to home blocks
+    for (tail = 0; tail < log.clh.n; tail++) {
+      bwait(log.lbuf[tail]);
+      bunpin(log.cbuf[tail]);
+    }
+    return;
+  }
+
+  // after a crash; intact() has read the log blocks.
+  for (tail = 0; tail < log.clh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
+    log.cbuf[tail] = bnew(log.dev, log.clh.block[tail]); // dst, overwritten
+    memmove(log.cbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  bstartv(log.cbuf, log.clh.n);  // write dsts to disk
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwait(log.cbuf[tail]);
+    brelse(log.cbuf[tail]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into the committing log header
 static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  log.clh.nd = lh->nd;
+  log.clh.sum = lh->sum;
+  if (log.clh.n < 0 || log.clh.n > LOGSIZE ||
+      log.clh.nd < 0 || log.clh.nd > LOGSIZE)
+    log.clh.n = log.clh.nd = 0;   // not a header we wrote
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
+  }
+  for (i = 0; i < log.clh.nd; i++) {
+    log.clh.dblock[i] = lh->dblock[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Copy the committing log header into a header block.
 static void
-write_head(void)
+fill_head(struct buf *buf)
 {
-  struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+
+  hb->n = log.clh.n;
+  hb->nd = log.clh.nd;
+  hb->sum = log.clh.sum;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
+  for (i = 0; i < log.clh.nd; i++) {
+    hb->dblock[i] = log.clh.dblock[i];
+  }
+}
+
+// Add block blockno's contents to checksum sum (32-bit FNV-1a,
+// a word at a time).
+static uint
+checksum(uint sum, uint blockno, uchar *data)
+{
+  uint *w = (uint *) data;
+  int i;
+
+  sum = (sum ^ blockno) * 16777619;
+  for (i = 0; i < BSIZE / sizeof(uint); i++)
+    sum = (sum ^ w[i]) * 16777619;
+  return sum;
+}
+
+// Write the committing log header to disk.
+static void
+write_head(void)
+{
+  struct buf *buf = bread(log.dev, log.start);
+  fill_head(buf);
   bwrite(buf);
   brelse(buf);
 }
 
+// Did all of the transaction in the log header reach the disk?
+// Reads the log blocks and the data blocks, and checks them
+// against the header's checksum.
+static int
+intact(void)
+{
+  uint blockno[LOGSIZE];
+  uint sum = 2166136261;
+  struct buf *b;
+  int i;
+
+  for (i = 0; i < log.clh.n; i++)
+    blockno[i] = log.start+i+1;
+  breadav(log.dev, blockno, log.clh.n);
+  for (i = 0; i < log.clh.nd; i++)
+    blockno[i] = log.clh.dblock[i];
+  breadav(log.dev, blockno, log.clh.nd);
+
+  for (i = 0; i < log.clh.n; i++) {
+    b = bread(log.dev, log.start+i+1);
+    sum = checksum(sum, log.clh.block[i], b->data);
+    brelse(b);
+  }
+  for (i = 0; i < log.clh.nd; i++) {
+    b = bread(log.dev, log.clh.dblock[i]);
+    sum = checksum(sum, log.clh.dblock[i], b->data);
+    brelse(b);
+  }
+  return sum == log.clh.sum;
+}
+
 static void
 recover_from_log(void)
 {
   read_head();
+  if (log.clh.n > 0 && !intact()) {
+    printf("log: discarding a torn transaction\n");
+    log.clh.n = 0;
+  }
   install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  log.clh.n = 0;
+  log.clh.nd = 0;
   write_head(); // clear the log
 }
 
@@ -128,10 +265,15 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
+      sleep(&log, &log.lock);
+    } else if(log.want && pending() > 0){
+      // let the transaction drain, so the flusher can commit it.
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(pending() + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      log.want = 1;
+      wakeup(&log.due);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -142,69 +284,196 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// the flusher commits the system call's updates later.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.copying)
+    panic("log.copying");
+  if(log.outstanding == 0 && pending() > 0 && (log.want || r_time() >= log.due))
+    wakeup(&log.due);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Wait until every FS system call that has finished is on
+// disk. Caller must not be in a transaction.
+void
+log_sync(void)
+{
+  uint64 seq;
+
+  acquire(&log.lock);
+  if(pending() > 0){
+    seq = log.seq;
+    log.want = 1;
+    if(log.outstanding == 0)
+      wakeup(&log.due);
   } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    // the last transaction may still be being written.
+    seq = log.seq - 1;
   }
+  while(log.done < seq)
+    sleep(&log, &log.lock);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// The flusher kernel thread. Commits the open transaction
+// when it is due or asked for and no system call is in it.
+static void
+flusher(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(pending() > 0 && r_time() >= log.due)
+      log.want = 1;
+    if(log.want && pending() > 0 && log.outstanding == 0){
+      commit();
+      continue;
+    }
+    if(pending() == 0)
+      log.want = 0;
+    if(pending() > 0 && !log.want)
+      sleeptimeout(&log.due, &log.lock, log.due);
+    else
+      sleep(&log.due, &log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the committing transaction's blocks from the cache to
+// log blocks, which keep the committed contents while the next
+// transaction changes the cache.
 static void
-write_log(void)
+copy_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    log.lbuf[tail] = bnew(log.dev, log.start+tail+1); // log block
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    memmove(log.lbuf[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Lock the committing transaction's data blocks, which
+// write_log() writes in place. They stay locked until they are
+// on disk, so the next transaction can't change them first.
 static void
-commit()
+lock_data(void)
+{
+  int i;
+
+  for (i = 0; i < log.cndata; i++)
+    bread(log.dev, log.cdbuf[i]->blockno);  // pinned, so cached
+}
+
+// Wait for the data blocks, and release them.
+static void
+wait_data(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int i;
+
+  for (i = 0; i < log.cndata; i++) {
+    bwait(log.cdbuf[i]);
+    bunpin(log.cdbuf[i]);
+    brelse(log.cdbuf[i]);
+  }
+  log.cndata = 0;
+}
+
+// Write the copies to the log, the data blocks in place, and
+// the header, which lists them all with their checksum, as one
+// batch. Writing the header is the true point at which the
+// transaction commits, but the disk may write the blocks in any
+// order, so all of them must be on disk before it can commit.
+static void
+write_log(void)
+{
+  static struct buf *b[1+2*LOGSIZE];  // only the flusher commits
+  uint sum = 2166136261;
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++)
+    sum = checksum(sum, log.clh.block[tail], log.lbuf[tail]->data);
+  log.clh.nd = log.cndata;
+  for (tail = 0; tail < log.cndata; tail++) {
+    log.clh.dblock[tail] = log.cdbuf[tail]->blockno;
+    sum = checksum(sum, log.clh.dblock[tail], log.cdbuf[tail]->data);
   }
+  log.clh.sum = sum;
+
+  b[0] = bread(log.dev, log.start);
+  fill_head(b[0]);
+  memmove(b+1, log.lbuf, log.clh.n * sizeof(log.lbuf[0]));
+  memmove(b+1+log.clh.n, log.cdbuf, log.cndata * sizeof(log.cdbuf[0]));
+  bstartv(b, 1+log.clh.n+log.cndata);  // sorted and merged together
+  for (tail = 0; tail < log.clh.n+1; tail++)
+    bwait(b[tail]);
+  brelse(b[0]);
+}
+
+// Commit the open transaction. Called by the flusher, with
+// log.lock held, when no system call is in the transaction.
+static void
+commit()
+{
+  uint64 seq;
+  int n, tail;
+
+  // take the open transaction, and open the next one.
+  // new system calls wait until its blocks are copied.
+  log.copying = 1;
+  log.want = 0;
+  seq = log.seq++;
+  log.clh = log.lh;
+  memmove(log.cbuf, log.buf, log.lh.n * sizeof(log.buf[0]));
+  log.cndata = log.ndata;
+  memmove(log.cdbuf, log.dbuf, log.ndata * sizeof(log.dbuf[0]));
+  log.lh.n = 0;
+  log.ndata = 0;
+  log.nfreed = 0;
+  release(&log.lock);
+  n = log.clh.n;
+  lock_data();
+  copy_log();
+
+  acquire(&log.lock);
+  log.copying = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  write_log();     // Write header and copied blocks to log -- the commit
+  wait_data();     // Data blocks, written along with them
+  install_trans(0); // Now install writes to home locations
+  log.clh.n = 0;
+  log.clh.nd = 0;
+  write_head();    // Erase the transaction from the log
+  for (tail = 0; tail < n; tail++)
+    brelse(log.lbuf[tail]);
+
+  acquire(&log.lock);
+  log.done = seq;
+  wakeup(&log);
+}
+
+// the first block of a transaction; the flusher sets its timer.
+// caller must hold log.lock.
+static void
+opened(void)
+{
+  log.due = r_time() + (uint64)COMMITMS * (TIMEFREQ / 1000);
+  wakeup(&log.due);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// the flusher's commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +486,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (pending() >= LOGSIZE || pending() >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -228,9 +497,81 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
+    log.buf[i] = b;
     log.lh.n++;
+    for (i = 0; i < log.ndata; i++) {
+      if (log.dbuf[i] == b)
+        break;
+    }
+    if (i < log.ndata) {
+      // a data block became metadata; it keeps its pin.
+      log.dbuf[i] = log.dbuf[--log.ndata];
+    } else {
+      bpin(b);
+      if (pending() == 1)
+        opened();
+    }
+  }
+  release(&log.lock);
+}
+
+// Like log_write(), for a block of file data. In ordered mode
+// the block is written in place, not logged, unless the
+// transaction already logs it or has freed it.
+void
+log_data(struct buf *b)
+{
+#ifdef JOURNAL_DATA
+  log_write(b);
+#else
+  int i;
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  for (i = 0; i < log.lh.n; i++) {
+    if (log.lh.block[i] == b->blockno) {  // already logged
+      release(&log.lock);
+      return;
+    }
+  }
+  for (i = 0; i < log.nfreed && i < LOGSIZE; i++) {
+    if (log.freed[i] == b->blockno)
+      break;
+  }
+  if (i < log.nfreed) {
+    release(&log.lock);
+    log_write(b);
+    return;
+  }
+
+  for (i = 0; i < log.ndata; i++) {
+    if (log.dbuf[i] == b)   // absorption
+      break;
+  }
+  if (i == log.ndata) {
+    if (pending() >= LOGSIZE)
+      panic("too big a transaction");
+    bpin(b);
+    log.dbuf[log.ndata++] = b;
+    if (pending() == 1)
+      opened();
   }
   release(&log.lock);
+#endif
 }
 
+// Record that the open transaction freed block b, so that
+// log_data() logs it if it is reused before the commit.
+// If too many blocks are freed, it logs all data blocks.
+void
+log_free(uint b)
+{
+  acquire(&log.lock);
+  if (log.nfreed < LOGSIZE)
+    log.freed[log.nfreed] = b;
+  if (log.nfreed <= LOGSIZE)
+    log.nfreed++;
+  release(&log.lock);
+}
@@ -21,6 +21,8 @@ main()
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    wheelinit();     // timer wheel
+    futexinit();     // futex locks
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
@@ -28,6 +30,7 @@ main()
     iinit();         // inode table
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
+    iosched_init();  // disk request queue
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
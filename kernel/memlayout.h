@@ -17,6 +17,11 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// core local interruptor (CLINT). writing 1 to a hart's
+// MSIP register sends it a machine-mode software interrupt.
+#define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -57,3 +62,7 @@
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// the trapframes of a process's other threads sit below
+// the first thread's.
+#define THREADFRAME(slot) (TRAPFRAME - (uint64)(slot)*PGSIZE)
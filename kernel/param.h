@@ -1,15 +1,29 @@
 #define NPROC        64  // maximum number of processes
+#define NTHREAD      16  // maximum threads per process
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
+#define NLOCK       512  // spinlocks tracked by lockstat()
+#define NSITE       256  // lock call sites tracked by locksites()
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12) // max data blocks in on-disk log
+#define COMMITMS     30    // most ms the log waits before committing
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define BCACHEPCT    25    // percent of RAM the block cache may grow to
+#define RAMIN        4     // initial read-ahead window, in blocks
+#define RAMAX        32    // largest read-ahead window
+#define MAXSEG       16    // most blocks in one disk request
+#define FSSIZE       2100  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define NPRIO        3     // scheduling priority levels; 0 is highest
+#define BOOSTTICKS   50    // ticks between priority boosts
+#define TIMEFREQ     10000000 // time counter cycles per second (qemu)
+#define NSPERCYCLE   (1000000000 / TIMEFREQ)
+#define TICKCYCLES   1000000 // timer cycles per tick, about 1/10th second
+#define IDLETICKS    100   // longest an idle hart sleeps with no deadline
 
@@ -68,6 +68,7 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    freelock(&pi->lock);
     kfree((char*)pi);
   } else
     release(&pi->lock);
@@ -3,7 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
+#include "pstat.h"
+#include "wait.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -15,17 +18,51 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// protects the pid and the UNUSED state of every proc, so
+// that looking a process up by pid needs neither a lock per
+// proc nor to exclude other lookups. Written only when a
+// proc is allocated or freed, with p->lock held; so a reader
+// must release it before acquiring any p->lock.
+struct rwlock proctable;
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static int threadmap(struct proc *p, struct proc *leader);
+static void siblingadd(struct proc **head, struct proc *p);
+static void threadunmap(struct proc *p);
+static void setrunnable(struct proc *p);
+static uint boostepoch(void);
+static struct proc *findproc(int pid);
 
 extern char trampoline[]; // trampoline.S
 
+#define ALLCPUS ((1U << NCPU) - 1)
+#define ALLOWED(p, c) (((p)->cpumask >> ((c) - cpus)) & 1)
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// Processes in sleep() are linked onto a wait queue chosen
+// by hashing chan, so that wakeup() only has to look at
+// processes that might be sleeping on chan instead of
+// locking every entry in proc[].
+// A waitq lock must be acquired before any p->lock.
+#define NWAITQ 61
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+static struct waitq*
+waitqof(void *chan)
+{
+  return &waitq[((uint64)chan >> 2) % NWAITQ];
+}
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -48,11 +85,19 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct waitq *wq;
+  struct cpu *c;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initrwlock(&proctable, "proctable");
+  for(wq = waitq; wq < &waitq[NWAITQ]; wq++)
+    initlock(&wq->lock, "waitq");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rq.lock, "runq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->tlock, "threads");
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
@@ -105,11 +150,15 @@ allocpid()
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
+// The new proc is the first thread of a new process with an
+// empty address space if leader is 0, and otherwise another
+// thread in leader's process.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *leader)
 {
   struct proc *p;
+  int pid;
 
   for(p = proc; p < &proc[NPROC]; p++) {
     acquire(&p->lock);
@@ -122,8 +171,21 @@ allocproc(void)
   return 0;
 
 found:
-  p->pid = allocpid();
+  pid = allocpid();
+  acquirewrite(&proctable);
+  p->pid = pid;
   p->state = USED;
+  releasewrite(&proctable);
+  p->priority = 0;
+  p->basepri = 0;
+  p->slice = 0;
+  p->epoch = boostepoch();
+  p->rtime = 0;
+  p->wtime = 0;
+  p->nsched = 0;
+  p->cpumask = ALLCPUS;
+  p->lastcpu = -1;
+  p->nmigrate = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -132,9 +194,18 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  if(leader == 0){
+    // An empty user page table.
+    p->leader = p;
+    p->tfslot = 0;
+    p->tfslots = 1;
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  } else if(threadmap(p, leader) < 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -155,20 +226,51 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  if(p->leader && p->leader != p)
+    threadunmap(p);
+  else if(p->pagetable)
+    proc_freepagetable(p->pagetable, p->sz);
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->leader = 0;
   p->sz = 0;
-  p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
+  acquirewrite(&proctable);
+  p->pid = 0;
   p->state = UNUSED;
+  releasewrite(&proctable);
+}
+
+// Find the process with the given pid, and return it
+// with p->lock held. Returns 0 if there is none.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquireread(&proctable);
+  for(p = proc; p < &proc[NPROC]; p++)
+    if(p->pid == pid && p->state != UNUSED)
+      break;
+  releaseread(&proctable);
+  if(p == &proc[NPROC])
+    return 0;
+
+  // p may have been freed in between; pids are
+  // never reused, so checking it again is enough.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -205,6 +307,49 @@ proc_pagetable(struct proc *p)
   return pagetable;
 }
 
+// Map the trapframe of p, a new thread in leader's
+// process, into the shared page table.
+// Caller must hold p->lock.
+static int
+threadmap(struct proc *p, struct proc *leader)
+{
+  int slot;
+
+  acquire(&leader->tlock);
+  for(slot = 1; slot < NTHREAD; slot++)
+    if((leader->tfslots & (1 << slot)) == 0)
+      break;
+  if(slot == NTHREAD ||
+     mappages(leader->pagetable, THREADFRAME(slot), PGSIZE,
+              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+    release(&leader->tlock);
+    return -1;
+  }
+  leader->tfslots |= 1 << slot;
+  release(&leader->tlock);
+
+  p->leader = leader;
+  p->tfslot = slot;
+  p->pagetable = leader->pagetable;
+  return 0;
+}
+
+// Undo threadmap() for a thread that has exited.
+// The leader is still around: it does not finish
+// exiting until its other threads have been freed.
+static void
+threadunmap(struct proc *p)
+{
+  struct proc *leader = p->leader;
+
+  if(p->pagetable == 0)
+    return;
+  acquire(&leader->tlock);
+  uvmunmap(p->pagetable, THREADFRAME(p->tfslot), 1, 0);
+  leader->tfslots &= ~(1 << p->tfslot);
+  release(&leader->tlock);
+}
+
 // Free a process's page table, and free the
 // physical memory it refers to.
 void
@@ -234,7 +379,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
@@ -249,29 +394,62 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
+// A kernel thread's first scheduling switches here.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread that runs fn(), which must not
+// return. It runs only in the kernel, and never uses the
+// user address space that allocproc() gives it.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size, which other threads may change
+// at any moment, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint64 sz;
-  struct proc *p = myproc();
+  uint64 sz, oldsz;
+  struct proc *p = myproc()->leader;
 
-  sz = p->sz;
+  acquire(&p->tlock);
+  sz = oldsz = p->sz;
   if(n > 0){
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+      release(&p->tlock);
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
-  return 0;
+  release(&p->tlock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -284,17 +462,25 @@ fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. Only the
+  // calling thread is copied.
+  acquire(&p->leader->tlock);
+  if(uvmcopy(p->pagetable, np->pagetable, p->leader->sz) < 0){
+    release(&p->leader->tlock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  np->sz = p->leader->sz;
+  release(&p->leader->tlock);
+
+  // uvmcopy() made the parent's pages read-only; the
+  // parent's other threads must not keep writing them.
+  tlbshootdown(p->pagetable);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -303,46 +489,212 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&p->leader->tlock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(p->leader->ofile[i])
+      np->ofile[i] = filedup(p->leader->ofile[i]);
+  np->cwd = idup(p->leader->cwd);
+  release(&p->leader->tlock);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  // the child starts at the parent's base priority,
+  // on the parent's CPUs.
+  np->basepri = p->basepri;
+  np->priority = p->basepri;
+  np->cpumask = p->cpumask;
+
   pid = np->pid;
 
   release(&np->lock);
 
+  // the child belongs to the process, not to the thread
+  // that forked it.
   acquire(&wait_lock);
-  np->parent = p;
+  np->parent = p->leader;
+  siblingadd(&p->leader->children, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Add p to a parent's children or zombies list.
+// Caller must hold wait_lock.
+static void
+siblingadd(struct proc **head, struct proc *p)
+{
+  p->sibling = *head;
+  if(*head)
+    (*head)->psibling = &p->sibling;
+  *head = p;
+  p->psibling = head;
+}
+
+// Remove p from the list it is on.
+// Caller must hold wait_lock.
+static void
+siblingdel(struct proc *p)
+{
+  *p->psibling = p->sibling;
+  if(p->sibling)
+    p->sibling->psibling = p->psibling;
+  p->sibling = 0;
+  p->psibling = 0;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
+  int zombies = p->zombies != 0;
+
+  while((pp = p->children) != 0){
+    siblingdel(pp);
+    pp->parent = initproc;
+    siblingadd(&initproc->children, pp);
+  }
+  while((pp = p->zombies) != 0){
+    siblingdel(pp);
+    pp->parent = initproc;
+    siblingadd(&initproc->zombies, pp);
+  }
+  if(zombies)
+    wakeup(initproc);
+}
+
+// Create a new thread in the calling process, sharing its
+// address space, open files and current directory. The
+// thread starts at user address fn with a0 set to arg and
+// its stack pointer set to stack. Returns the new thread's
+// id, which is a pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int tid;
+  struct proc *np;
+  struct proc *p = myproc();
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
+  if((np = allocproc(p->leader)) == 0)
+    return -1;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->basepri = p->basepri;
+  np->priority = p->basepri;
+  np->cpumask = p->cpumask;
+
+  tid = np->pid;
+
+  release(&np->lock);
+
+  // join() and the leader's exit() find the thread
+  // through its leader, and sleep on the leader.
+  acquire(&wait_lock);
+  np->parent = p->leader;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return tid;
+}
+
+// Wait for thread tid of the calling process to exit, or
+// for any of its threads if tid is -1, and return the id.
+// Return -1 if there is no such thread.
+int
+join(int tid)
+{
+  struct proc *pp;
+  struct proc *p = myproc();
+  struct proc *leader = p->leader;
+  int havethreads, id;
+
+  acquire(&wait_lock);
+
+  for(;;){
+    havethreads = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp == p || pp == leader || pp->parent != leader)
+        continue;
+      acquire(&pp->lock);
+      if(pp->leader == leader && (tid == -1 || pp->pid == tid)){
+        havethreads = 1;
+        if(pp->state == ZOMBIE){
+          id = pp->pid;
+          freeproc(pp);
+          release(&pp->lock);
+          release(&wait_lock);
+          return id;
+        }
+      }
+      release(&pp->lock);
+    }
+
+    if(!havethreads || killed(p)){
+      release(&wait_lock);
+      return -1;
+    }
+
+    // a thread's exit() wakes its leader.
+    sleep(leader, &wait_lock);
+  }
+}
+
+// Kill the other threads of process p, which is exiting,
+// and free them once they have exited.
+static void
+reapthreads(struct proc *p)
+{
+  struct proc *pp;
+  int alive;
+
+  acquire(&wait_lock);
+  for(;;){
+    alive = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp == p)
+        continue;
+      // check leader rather than parent, to catch a
+      // thread that clone() has not finished setting up.
+      acquire(&pp->lock);
+      if(pp->leader == p){
+        if(pp->state == ZOMBIE){
+          freeproc(pp);
+        } else {
+          pp->killed = 1;
+          if(pp->state == SLEEPING)
+            setrunnable(pp);
+          alive = 1;
+        }
+      }
+      release(&pp->lock);
     }
+    if(!alive)
+      break;
+    sleep(p, &wait_lock);
   }
+  release(&wait_lock);
 }
 
-// Exit the current process.  Does not return.
-// An exited process remains in the zombie state
-// until its parent calls wait().
+// Exit the current thread.  Does not return.
+// If it is the first thread of its process, the whole
+// process exits: the other threads are killed, and the
+// process remains in the zombie state until its parent
+// calls wait(). Any other thread remains a zombie until
+// a join() or the process's exit.
 void
 exit(int status)
 {
@@ -351,26 +703,31 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
+  if(p->leader == p){
+    reapthreads(p);
+
+    // Close all open files.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(p->ofile[fd]){
+        struct file *f = p->ofile[fd];
+        fileclose(f);
+        p->ofile[fd] = 0;
+      }
     }
-  }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+    begin_op();
+    iput(p->cwd);
+    end_op();
+    p->cwd = 0;
+  }
 
   acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
+  // Parent might be sleeping in wait(), or for
+  // a thread, the leader in join() or exit().
   wakeup(p->parent);
   
   acquire(&p->lock);
@@ -378,6 +735,12 @@ exit(int status)
   p->xstate = status;
   p->state = ZOMBIE;
 
+  // threads are not on their leader's lists.
+  if(p->leader == p){
+    siblingdel(p);
+    siblingadd(&p->parent->zombies, p);
+  }
+
   release(&wait_lock);
 
   // Jump into the scheduler, never to return.
@@ -389,55 +752,413 @@ exit(int status)
 // Return -1 if this process has no children.
 int
 wait(uint64 addr)
+{
+  return waitpid(-1, addr, 0);
+}
+
+// Wait for child process pid to exit, or any child if pid
+// is -1, and return its pid. Return -1 if there is no such
+// child, or 0 if options has WNOHANG and it is still running.
+// Exited children are on p->zombies, so this only looks at
+// the caller's own children, never the whole proc table.
+// Any thread may wait for children forked by any other.
+int
+waitpid(int pid, uint64 addr, int options)
 {
   struct proc *pp;
-  int havekids, pid;
-  struct proc *p = myproc();
+  int havekids, rpid;
+  struct proc *p = myproc()->leader;
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
-          release(&pp->lock);
-          release(&wait_lock);
-          return pid;
-        }
+    for(pp = p->zombies; pp; pp = pp->sibling)
+      if(pid == -1 || pp->pid == pid)
+        break;
+    if(pp){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+      rpid = pp->pid;
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                              sizeof(pp->xstate)) < 0) {
         release(&pp->lock);
+        release(&wait_lock);
+        return -1;
       }
+      siblingdel(pp);
+      freeproc(pp);
+      release(&pp->lock);
+      release(&wait_lock);
+      return rpid;
     }
 
+    havekids = 0;
+    for(pp = p->children; pp && !havekids; pp = pp->sibling)
+      if(pid == -1 || pp->pid == pid)
+        havekids = 1;
+
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(!havekids || killed(myproc())){
       release(&wait_lock);
       return -1;
     }
+    if(options & WNOHANG){
+      release(&wait_lock);
+      return 0;
+    }
     
     // Wait for a child to exit.
     sleep(p, &wait_lock);  //DOC: wait-sleep
   }
 }
 
+// Multi-level feedback queue scheduling.
+// A process runs for QUANTUM(level) timer ticks at a level
+// before it is moved down one level, so CPU-bound processes
+// sink while processes that sleep early stay near the top.
+// Every BOOSTTICKS ticks all processes return to their base
+// level so that nothing starves at the bottom.
+#define QUANTUM(lvl) (1 << (lvl))
+
+// The current boost epoch.
+static uint
+boostepoch(void)
+{
+  return ticks / BOOSTTICKS;
+}
+
+// Apply a priority boost that p has not seen yet.
+// Boosts are applied lazily, whenever p is queued,
+// dispatched, or charged a tick, so a boost never has
+// to visit every process.
+// Caller must hold p->lock.
+static void
+boost(struct proc *p)
+{
+  uint epoch = boostepoch();
+
+  if(p->epoch != epoch){
+    p->epoch = epoch;
+    p->priority = p->basepri;
+    p->slice = 0;
+  }
+}
+
+// Append p to the tail of level lvl of rq.
+// Caller must hold rq->lock.
+static void
+rqappend(struct runq *rq, int lvl, struct proc *p)
+{
+  p->rqnext = 0;
+  if(rq->level[lvl].tail)
+    rq->level[lvl].tail->rqnext = p;
+  else
+    rq->level[lvl].head = p;
+  rq->level[lvl].tail = p;
+}
+
+// Move the processes queued on rq back to their
+// base levels after a boost.
+// Caller must hold rq->lock.
+static void
+rqboost(struct runq *rq, uint epoch)
+{
+  struct proc *p, *next, *list, **tailp;
+  int lvl;
+
+  list = 0;
+  tailp = &list;
+  for(lvl = 0; lvl < NPRIO; lvl++){
+    if(rq->level[lvl].head){
+      *tailp = rq->level[lvl].head;
+      tailp = &rq->level[lvl].tail->rqnext;
+    }
+    rq->level[lvl].head = 0;
+    rq->level[lvl].tail = 0;
+  }
+  for(p = list; p; p = next){
+    next = p->rqnext;
+    rqappend(rq, p->basepri, p);
+  }
+  rq->epoch = epoch;
+}
+
+// Queue p on rq at p's current priority level.
+static void
+runqput(struct runq *rq, struct proc *p)
+{
+  acquire(&rq->lock);
+  rqappend(rq, p->priority, p);
+  rq->n++;
+  release(&rq->lock);
+}
+
+// If p is queued on some CPU's run queue, move it to the
+// level for its current priority. Caller must hold p->lock.
+static void
+runqrequeue(struct proc *p)
+{
+  struct cpu *c;
+  struct runq *rq;
+  struct proc *q, *prev;
+  int lvl;
+
+  if(p->state != RUNNABLE)
+    return;
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    rq = &c->rq;
+    acquire(&rq->lock);
+    for(lvl = 0; lvl < NPRIO; lvl++){
+      prev = 0;
+      for(q = rq->level[lvl].head; q; prev = q, q = q->rqnext)
+        if(q == p)
+          break;
+      if(q){
+        if(prev)
+          prev->rqnext = p->rqnext;
+        else
+          rq->level[lvl].head = p->rqnext;
+        if(rq->level[lvl].tail == p)
+          rq->level[lvl].tail = prev;
+        rqappend(rq, p->priority, p);
+        release(&rq->lock);
+        return;
+      }
+    }
+    release(&rq->lock);
+  }
+  // a CPU has just taken p off its queue, to run it.
+}
+
+// Remove and return the first process on the highest
+// non-empty level of rq, or 0 if rq is empty.
+// If c is not 0, only consider processes allowed
+// to run on CPU c.
+static struct proc*
+runqget(struct runq *rq, struct cpu *c)
+{
+  struct proc *p = 0, *prev;
+  uint epoch = boostepoch();
+  int lvl;
+
+  acquire(&rq->lock);
+  if(rq->epoch != epoch)
+    rqboost(rq, epoch);
+  for(lvl = 0; lvl < NPRIO; lvl++){
+    prev = 0;
+    for(p = rq->level[lvl].head; p; prev = p, p = p->rqnext)
+      if(c == 0 || ALLOWED(p, c))
+        break;
+    if(p){
+      if(prev)
+        prev->rqnext = p->rqnext;
+      else
+        rq->level[lvl].head = p->rqnext;
+      if(rq->level[lvl].tail == p)
+        rq->level[lvl].tail = prev;
+      p->rqnext = 0;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// If CPU c is idle, wake it with an IPI, so that it looks
+// for work instead of sleeping until its next timer
+// deadline. See machinevec in kernelvec.S.
+// Returns 1 if c was idle.
+static int
+kickcpu(struct cpu *c)
+{
+  if(!c->idle)
+    return 0;
+  c->idle = 0;
+  *(volatile uint32 *)CLINT_MSIP(c - cpus) = 1;
+  return 1;
+}
+
+// Wake an idle CPU, so that it steals work queued
+// on a busy one.
+static void
+kick(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(kickcpu(c))
+      return;
+}
+
+// Make sure that no other CPU goes on using stale TLB
+// entries for pagetable after its PTEs were changed, as
+// when a thread breaks a COW page that its process's other
+// threads may be reading. Every return to user space flushes
+// the TLB (see userret in trampoline.S), and the kernel walks
+// user page tables in software, so only CPUs that are in user
+// space with pagetable need to be interrupted, and they only
+// need to trap into the kernel once: usertrap() counts that
+// before it does anything else.
+void
+tlbshootdown(pagetable_t pagetable)
+{
+  struct cpu *c;
+  struct proc *p;
+  uint64 gen;
+
+  __sync_synchronize();
+  push_off();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c == mycpu())
+      continue;
+    gen = __atomic_load_n(&c->ugen, __ATOMIC_SEQ_CST);
+    p = c->proc;
+    if((gen & 1) == 0 || p == 0 || p->pagetable != pagetable)
+      continue;
+    *(volatile uint32 *)CLINT_MSIP(c - cpus) = 1;
+    while(__atomic_load_n(&c->ugen, __ATOMIC_SEQ_CST) == gen)
+      ;
+  }
+  pop_off();
+}
+
+// Choose the CPU whose run queue p should join: this one
+// if p may run here, so that a woken process starts where
+// its waker left the data it needs; otherwise the CPU p
+// last ran on, whose cache may still be warm; otherwise
+// the least loaded CPU that p may use.
+static struct cpu*
+pickcpu(struct proc *p)
+{
+  struct cpu *c = mycpu(), *best = 0;
+
+  if(ALLOWED(p, c))
+    return c;
+  if(p->lastcpu >= 0 && ALLOWED(p, &cpus[p->lastcpu]))
+    return &cpus[p->lastcpu];
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->started && ALLOWED(p, c) && (best == 0 || c->rq.n < best->rq.n))
+      best = c;
+  // setaffinity() only accepts masks with a started CPU.
+  return best ? best : mycpu();
+}
+
+// Mark p RUNNABLE and queue it on the run queue of a CPU
+// that p is allowed to run on, preferably this one.
+// Caller must hold p->lock, which also keeps
+// interrupts off so mycpu() is stable.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c;
+  int local;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  boost(p);
+  p->state = RUNNABLE;
+  p->readystart = r_time();
+  c = pickcpu(p);
+  runqput(&c->rq, p);
+  if(c != mycpu()){
+    kickcpu(c);
+    return;
+  }
+
+  // this CPU will get to one queued process right away if
+  // it is idle, or if p is the process giving it up; ask
+  // an idle CPU to take anything beyond that.
+  local = (c->proc == 0 || c->proc == p);
+  if(c->rq.n > local)
+    kick();
+}
+
+// Is there a queued process that CPU c could run?
+static int
+anyqueued(struct cpu *c)
+{
+  struct cpu *v;
+  struct proc *p;
+  int lvl, found = 0;
+
+  if(c->rq.n > 0)
+    return 1;
+  for(v = cpus; v < &cpus[NCPU] && !found; v++){
+    if(v->rq.n == 0)
+      continue;
+    acquire(&v->rq.lock);
+    for(lvl = 0; lvl < NPRIO && !found; lvl++)
+      for(p = v->rq.level[lvl].head; p && !found; p = p->rqnext)
+        found = ALLOWED(p, c);
+    release(&v->rq.lock);
+  }
+  return found;
+}
+
+// Take a process that may run on c from the CPU with the
+// longest run queue, or failing that, from any CPU.
+// The unlocked peeks at rq.n are only hints; runqget()
+// copes with a queue having drained in the meantime.
+static struct proc*
+steal(struct cpu *c)
+{
+  struct cpu *v, *victim = 0;
+  struct proc *p;
+  int most = 0;
+
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v != c && v->rq.n > most){
+      most = v->rq.n;
+      victim = v;
+    }
+  }
+  if(victim == 0)
+    return 0;
+  if((p = runqget(&victim->rq, c)) != 0)
+    return p;
+  // everything there may be pinned elsewhere.
+  for(v = cpus; v < &cpus[NCPU]; v++)
+    if(v != c && v != victim && v->rq.n > 0 && (p = runqget(&v->rq, c)) != 0)
+      return p;
+  return 0;
+}
+
+// Charge the current process for a timer tick.
+// Returns 1 if it should yield the CPU: either it has
+// used up its quantum, and has been moved down a level,
+// or a higher-priority process is waiting on this CPU.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+  int lvl, preempt = 0;
+
+  acquire(&p->lock);
+  boost(p);
+  if(++p->slice >= QUANTUM(p->priority)){
+    if(p->priority < NPRIO-1)
+      p->priority++;
+    p->slice = 0;
+    preempt = 1;
+  } else {
+    rq = &mycpu()->rq;
+    acquire(&rq->lock);
+    for(lvl = 0; lvl < p->priority; lvl++)
+      if(rq->level[lvl].head)
+        preempt = 1;
+    release(&rq->lock);
+  }
+  release(&p->lock);
+  return preempt;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run from this CPU's run queue,
+//    or steal one from a busier CPU.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -448,35 +1169,70 @@ scheduler(void)
   struct cpu *c = mycpu();
 
   c->proc = 0;
+  c->started = 1;
   for(;;){
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
     // processes are waiting.
     intr_on();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
+    if((p = runqget(&c->rq, 0)) == 0)
+      p = steal(c);
+    if(p == 0) {
+      // nothing to run; stop running on this core until an
+      // interrupt. announce that we are idle, so setrunnable()
+      // will kick us, then check once more for work queued
+      // before the announcement was visible. interrupts stay
+      // off until after wfi, which still wakes for a pending
+      // interrupt, so a wakeup from an interrupt handler
+      // cannot slip in between the check and wfi.
+      intr_off();
+      c->idle = 1;
+      __sync_synchronize();
+      if(!anyqueued(c)){
+        clockset();
+        asm volatile("wfi");
       }
-      release(&p->lock);
+      c->idle = 0;
+      continue;
     }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
-      intr_on();
-      asm volatile("wfi");
+
+    // p may still be on its way out of yield() on another
+    // CPU; acquiring p->lock waits until that CPU's
+    // scheduler has switched away from it.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE && !ALLOWED(p, c)){
+      // setaffinity() moved p off this CPU while it was
+      // queued here; pass it on to one it may use. not
+      // setrunnable(), since p has been waiting all along.
+      struct cpu *to = pickcpu(p);
+      boost(p);
+      runqput(&to->rq, p);
+      kickcpu(to);
+    } else if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      boost(p);
+      p->state = RUNNING;
+      p->runstart = r_time();
+      p->wtime += p->runstart - p->readystart;
+      p->nsched++;
+      if(p->lastcpu != c - cpus){
+        if(p->lastcpu >= 0)
+          p->nmigrate++;
+        p->lastcpu = c - cpus;
+      }
+      c->proc = p;
+      if(c->tickless)
+        clockset();
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -502,6 +1258,8 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  p->rtime += r_time() - p->runstart;
+
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -513,7 +1271,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -546,30 +1304,61 @@ forkret(void)
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
+{
+  sleep2(chan, lk, 0);
+}
+
+// Like sleep(), but also release lk2, if it is not 0, once
+// this process is on the wait queue, so that a wakeup(chan)
+// by someone holding either lock can't be missed. Only lk
+// is reacquired.
+void
+sleep2(void *chan, struct spinlock *lk, struct spinlock *lk2)
 {
   struct proc *p = myproc();
+  struct waitq *wq = waitqof(chan);
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold wq->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
+  // (wakeup locks wq->lock, and will find
+  // us on the queue), so it's okay to release lk.
 
+  acquire(&wq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
+  if(lk2)
+    release(lk2);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = wq->head;
+  wq->head = p;
+  release(&wq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // Leave the wait queue. wakeup() and kill() never unlink
+  // a process themselves, so they need not take wq->lock
+  // while holding a p->lock.
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      break;
+    }
+  }
+  p->wqnext = 0;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -578,17 +1367,57 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *me = myproc();
+  struct waitq *wq = waitqof(chan);
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = p->wqnext) {
+    if(p != me){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
+}
+
+// Wake up at most n of the processes sleeping on chan,
+// those that have slept longest, and return how many.
+// sleep() pushes onto the front of the wait queue, so
+// they are the last ones on it.
+// Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *p, *me = myproc();
+  struct waitq *wq = waitqof(chan);
+  int nsleeping = 0, woken = 0;
+
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = p->wqnext)
+    if(p != me && p->state == SLEEPING && p->chan == chan)
+      nsleeping++;
+  // skip the newest nsleeping-n. if kill() wakes one of
+  // them meanwhile, the count is off, so go round again
+  // from the front for any wakeups still owed.
+  for(int pass = 0; pass < 2 && woken < n; pass++){
+    for(p = wq->head; p && woken < n; p = p->wqnext) {
+      if(p != me){
+        acquire(&p->lock);
+        if(p->state == SLEEPING && p->chan == chan) {
+          if(pass == 1 || nsleeping-- <= n){
+            setrunnable(p);
+            woken++;
+          }
+        }
+        release(&p->lock);
+      }
+    }
+  }
+  release(&wq->lock);
+  return woken;
 }
 
 // Kill the process with the given pid.
@@ -599,20 +1428,20 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0)
+    return -1;
+  if(p->kfn){
+    // kernel threads never exit.
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
+  }
+  release(&p->lock);
+  return 0;
 }
 
 void
@@ -634,6 +1463,92 @@ killed(struct proc *p)
   return k;
 }
 
+// Set the base priority level of process pid, and move it
+// to that level now. Returns the old base level, or -1 if
+// there is no such process or prio is out of range.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+  int old;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  old = p->basepri;
+  p->basepri = prio;
+  p->priority = prio;
+  p->slice = 0;
+  runqrequeue(p);
+  release(&p->lock);
+  return old;
+}
+
+// Restrict process pid to the CPUs in mask, bit i for
+// cpus[i]. Returns the old mask, or -1 if there is no such
+// process or mask names no CPU that has started.
+// A queued process moves when a CPU next dequeues it, and
+// a running one when it next gives up its CPU; the caller
+// moves right away.
+int
+setaffinity(int pid, int mask)
+{
+  struct proc *p;
+  struct cpu *c;
+  int old, ok = 0;
+
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    if(c->started && ((mask >> (c - cpus)) & 1))
+      ok = 1;
+  if(!ok)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  old = p->cpumask;
+  p->cpumask = mask & ALLCPUS;
+  release(&p->lock);
+  if(p == myproc()){
+    push_off();
+    ok = ALLOWED(p, mycpu());
+    pop_off();
+    if(!ok)
+      yield();
+  }
+  return old;
+}
+
+// Copy scheduling statistics for process pid
+// to the struct pstat at user virtual address addr.
+// Returns 0 on success, -1 on error.
+int
+getpstat(int pid, uint64 addr)
+{
+  struct proc *p;
+  struct pstat st;
+  uint64 now;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  now = r_time();
+  st.pid = p->pid;
+  st.priority = p->priority;
+  st.basepri = p->basepri;
+  st.rtime = p->rtime;
+  st.wtime = p->wtime;
+  st.nsched = p->nsched;
+  st.cpumask = p->cpumask;
+  st.lastcpu = p->lastcpu;
+  st.nmigrate = p->nmigrate;
+  // include the interval p is in right now.
+  if(p->state == RUNNING)
+    st.rtime += now - p->runstart;
+  else if(p->state == RUNNABLE)
+    st.wtime += now - p->readystart;
+  release(&p->lock);
+  return copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st));
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -666,7 +1581,9 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Takes only the proctable read lock, which keeps procs from
+// being freed under it but doesn't stop them running; no
+// p->lock, to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
@@ -682,6 +1599,7 @@ procdump(void)
   char *state;
 
   printf("\n");
+  acquireread(&proctable);
   for(p = proc; p < &proc[NPROC]; p++){
     if(p->state == UNUSED)
       continue;
@@ -689,7 +1607,9 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s prio %d cpu %d migr %lu", p->pid, state, p->name,
+           p->priority, p->lastcpu, p->nmigrate);
     printf("\n");
   }
+  releaseread(&proctable);
 }
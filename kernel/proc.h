@@ -18,12 +18,33 @@ struct context {
   uint64 s11;
 };
 
+// Per-CPU queues of RUNNABLE processes, one per priority
+// level, linked through p->rqnext.
+struct runq {
+  struct spinlock lock;
+  struct {
+    struct proc *head;        // Next process to run at this level.
+    struct proc *tail;
+  } level[NPRIO];
+  int n;                      // Number of queued processes.
+  uint epoch;                 // Boost epoch the levels belong to.
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq rq;             // Processes waiting to run on this cpu.
+  int started;                // Has entered scheduler().
+  int idle;                   // In wfi with nothing to run; kick() me.
+  int tickless;               // Timer set for an idle deadline, see clockset().
+  uint64 nexttick;            // When the running process's current tick ends.
+  uint64 ntimer;              // Timer interrupts taken.
+  uint64 ndevintr;            // Device interrupts taken.
+  uint64 nipi;                // IPIs taken.
+  uint64 ugen;                // Odd while in user space; see tlbshootdown().
 };
 
 extern struct cpu cpus[NCPU];
@@ -88,20 +109,47 @@ struct proc {
   // p->lock must be held when using these:
   enum procstate state;        // Process state
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *wqnext;         // Next on chan's wait queue (waitq lock)
+  struct proc *rqnext;         // Next on a cpu's run queue (runq lock)
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int priority;                // MLFQ level, 0 is highest
+  int basepri;                 // Level restored by a priority boost
+  int slice;                   // Timer ticks used at this level
+  uint epoch;                  // Boost epoch priority belongs to
+  uint64 readystart;           // r_time() when last made RUNNABLE
+  uint64 runstart;             // r_time() when last dispatched
+  uint64 rtime;                // Cycles spent RUNNING
+  uint64 wtime;                // Cycles spent RUNNABLE
+  uint64 nsched;               // Times dispatched by scheduler()
+  uint cpumask;                // CPUs p may run on, bit i for cpus[i]
+  int lastcpu;                 // CPU p last ran on, or -1
+  uint64 nmigrate;             // Dispatches on a CPU other than lastcpu
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // Live children, linked by sibling
+  struct proc *zombies;        // Exited children waiting for wait()
+  struct proc *sibling;        // Next on parent's children or zombies
+  struct proc **psibling;      // Previous sibling's link to this one
 
-  // these are private to the process, so p->lock need not be held.
+  // these are private to the thread, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  pagetable_t pagetable;       // User page table, shared by threads
+  struct proc *leader;         // First thread of the process; p if p is one
   struct trapframe *trapframe; // data page for trampoline.S
+  int tfslot;                  // trapframe is mapped at THREADFRAME(tfslot)
   struct context context;      // swtch() here to run process
+  char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // a kernel thread's function, or 0
+
+  // these belong to the process and are shared by its
+  // threads: use p->leader's. tlock must be held to change
+  // them while other threads may be running.
+  struct spinlock tlock;
+  uint64 sz;                   // Size of process memory (bytes)
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
-  char name[16];               // Process name (debugging)
+  uint tfslots;                // THREADFRAME slots in use
 };
@@ -0,0 +1,12 @@
+// Per-process scheduling statistics, returned by getpstat().
+struct pstat {
+  int pid;
+  int priority;       // current MLFQ level, 0 is highest
+  int basepri;        // level restored by each priority boost
+  uint64 rtime;       // cycles spent running
+  uint64 wtime;       // cycles spent runnable but waiting for a cpu
+  uint64 nsched;      // number of times dispatched
+  uint cpumask;       // cpus the process may run on
+  int lastcpu;        // cpu it last ran on, or -1
+  uint64 nmigrate;    // dispatches on a different cpu than the last
+};
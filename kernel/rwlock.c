@@ -0,0 +1,117 @@
+// Reader-writer spin locks.
+//
+// For data that is read much more often than it is written,
+// such as the inode table and the pid of each proc. Readers
+// hold the lock together; a writer excludes everyone. A
+// waiting writer keeps new readers out, so a stream of
+// readers can't starve it.
+//
+// The state is kept under an ordinary spinlock, which is
+// held only long enough to update it, and waiters spin
+// outside it. Like a spinlock, an rwlock is held with
+// interrupts off. A hart must not acquire the read lock
+// twice: with a writer waiting in between, it would wait
+// for itself.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  initlock(&rw->lk, name);
+  rw->readers = 0;
+  rw->writer = 0;
+  rw->wwait = 0;
+  rw->cpu = 0;
+}
+
+void
+acquireread(struct rwlock *rw)
+{
+  uint64 start = 0;
+
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(rw))
+    panic("acquireread");
+  for(;;){
+    acquire(&rw->lk);
+    if(rw->writer == 0 && rw->wwait == 0){
+      rw->readers++;
+      if(start)
+        recordwait((uint64)__builtin_return_address(0), rw->lk.name, 0, r_time() - start);
+      release(&rw->lk);
+      return;
+    }
+    release(&rw->lk);
+    if(start == 0)
+      start = r_time();
+    while(__atomic_load_n(&rw->writer, __ATOMIC_RELAXED) ||
+          __atomic_load_n(&rw->wwait, __ATOMIC_RELAXED))
+      ;
+  }
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  acquire(&rw->lk);
+  if(rw->readers < 1)
+    panic("releaseread");
+  rw->readers--;
+  release(&rw->lk);
+  pop_off();
+}
+
+void
+acquirewrite(struct rwlock *rw)
+{
+  uint64 start = 0;
+
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(rw))
+    panic("acquirewrite");
+  acquire(&rw->lk);
+  rw->wwait++;
+  while(rw->writer || rw->readers){
+    if(start == 0)
+      start = r_time();
+    release(&rw->lk);
+    while(__atomic_load_n(&rw->writer, __ATOMIC_RELAXED) ||
+          __atomic_load_n(&rw->readers, __ATOMIC_RELAXED))
+      ;
+    acquire(&rw->lk);
+  }
+  rw->wwait--;
+  rw->writer = 1;
+  rw->cpu = mycpu();
+  if(start)
+    recordwait((uint64)__builtin_return_address(0), rw->lk.name, 0, r_time() - start);
+  release(&rw->lk);
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  if(!holdingwrite(rw))
+    panic("releasewrite");
+  acquire(&rw->lk);
+  rw->writer = 0;
+  rw->cpu = 0;
+  release(&rw->lk);
+  pop_off();
+}
+
+// Check whether this cpu holds the write lock.
+// Interrupts must be off.
+int
+holdingwrite(struct rwlock *rw)
+{
+  return rw->writer && rw->cpu == mycpu();
+}
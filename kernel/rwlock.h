@@ -0,0 +1,8 @@
+// Reader-writer spin lock: any number of readers, or one writer.
+struct rwlock {
+  struct spinlock lk; // protects the fields below
+  int readers;        // number of readers holding the lock
+  int writer;         // held by a writer?
+  int wwait;          // writers waiting; new readers hold off
+  struct cpu *cpu;    // the cpu of the writer holding the lock
+};
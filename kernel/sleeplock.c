@@ -18,12 +18,29 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->pid = 0;
 }
 
+// Like initsleeplock(), but not listed for lockstat();
+// see initlockquiet().
+void
+initsleeplockquiet(struct sleeplock *lk, char *name)
+{
+  initlockquiet(&lk->lk, "sleep lock");
+  lk->name = name;
+  lk->locked = 0;
+  lk->pid = 0;
+}
+
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 start;
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  if (lk->locked) {
+    start = r_time();
+    while (lk->locked) {
+      sleep(lk, &lk->lk);
+    }
+    recordwait((uint64)__builtin_return_address(0), lk->name, 1, r_time() - start);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
@@ -51,5 +68,83 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+void
+initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "rwsleep lock");
+  lk->name = name;
+  lk->readers = 0;
+  lk->writer = 0;
+  lk->wwait = 0;
+  lk->pid = 0;
+}
+
+void
+acquirereadsleep(struct rwsleeplock *lk)
+{
+  uint64 start;
 
+  acquire(&lk->lk);
+  if (lk->writer || lk->wwait) {
+    start = r_time();
+    while (lk->writer || lk->wwait) {
+      sleep(lk, &lk->lk);
+    }
+    recordwait((uint64)__builtin_return_address(0), lk->name, 1, r_time() - start);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasereadsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasereadsleep");
+  lk->readers--;
+  if(lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
 
+void
+acquirewritesleep(struct rwsleeplock *lk)
+{
+  uint64 start;
+
+  acquire(&lk->lk);
+  lk->wwait++;
+  if (lk->writer || lk->readers) {
+    start = r_time();
+    while (lk->writer || lk->readers) {
+      sleep(lk, &lk->lk);
+    }
+    recordwait((uint64)__builtin_return_address(0), lk->name, 1, r_time() - start);
+  }
+  lk->wwait--;
+  lk->writer = 1;
+  lk->pid = myproc()->pid;
+  release(&lk->lk);
+}
+
+void
+releasewritesleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->writer = 0;
+  lk->pid = 0;
+  wakeup(lk);
+  release(&lk->lk);
+}
+
+int
+holdingwritesleep(struct rwsleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->writer && (lk->pid == myproc()->pid);
+  release(&lk->lk);
+  return r;
+}
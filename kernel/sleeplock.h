@@ -8,3 +8,15 @@ struct sleeplock {
   int pid;           // Process holding lock
 };
 
+// Long-term reader-writer locks: any number of readers, or
+// one writer. A waiting writer keeps new readers out.
+struct rwsleeplock {
+  struct spinlock lk; // spinlock protecting the fields below
+  int readers;        // number of readers holding the lock
+  int writer;         // held by a writer?
+  int wwait;          // writers waiting
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding the write lock
+};
@@ -7,13 +7,86 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
 
+// Every initialized lock, for lockstat(). locklist.lock
+// needs no initlock(): the all-zero lock is unlocked.
+static struct {
+  struct spinlock lock;
+  struct spinlock *lk[NLOCK];
+} locklist = { .lock = { .name = "locklist" } };
+
+// The places that waited for locks, found by hashing the
+// return address of the acquire call, for locksites().
+// Only acquisitions that had to wait are recorded, so the
+// uncontended path stays cheap. The table is guarded by a
+// bare test-and-set word, since acquire() itself records
+// here.
+static struct {
+  uint lock;
+  struct site {
+    uint64 pc;         // 0 if the slot is free
+    char *name;
+    int sleep;
+    uint64 ncontend;
+    uint64 wait;
+  } site[NSITE];
+} sites;
+
+// Initialize lk without listing it for lockstat(), for locks
+// that come and go in large numbers, such as the buffer
+// cache's. Waits for it are still counted by locksites().
 void
-initlock(struct spinlock *lk, char *name)
+initlockquiet(struct spinlock *lk, char *name)
 {
   lk->name = name;
+#ifdef SPINLOCK_TAS
   lk->locked = 0;
+#else
+  lk->next = 0;
+  lk->owner = 0;
+#endif
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->ncontend = 0;
+  lk->nspin = 0;
+  lk->wait = 0;
+}
+
+void
+initlock(struct spinlock *lk, char *name)
+{
+  int i, free = -1;
+
+  initlockquiet(lk, name);
+
+  // a lock that finds the list full is not tracked.
+  acquire(&locklist.lock);
+  for(i = 0; i < NLOCK; i++){
+    if(locklist.lk[i] == lk)
+      break;
+    if(locklist.lk[i] == 0 && free < 0)
+      free = i;
+  }
+  if(i == NLOCK && free >= 0)
+    locklist.lk[free] = lk;
+  release(&locklist.lock);
+}
+
+// Forget a lock that is about to be freed, such as a pipe's.
+void
+freelock(struct spinlock *lk)
+{
+  int i;
+
+  acquire(&locklist.lock);
+  for(i = 0; i < NLOCK; i++){
+    if(locklist.lk[i] == lk){
+      locklist.lk[i] = 0;
+      break;
+    }
+  }
+  release(&locklist.lock);
 }
 
 // Acquire the lock.
@@ -21,16 +94,32 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint64 spins = 0, start = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+#ifdef SPINLOCK_TAS
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    if(spins++ == 0)
+      start = r_time();
+  }
+#else
+  // Take a ticket with an atomic add (amoadd.w), then wait
+  // for the holder to serve it. Waiters only read owner, so
+  // the cache line is not bounced back and forth by writes
+  // while the lock is held.
+  uint ticket = __sync_fetch_and_add(&lk->next, 1);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) != ticket){
+    if(spins++ == 0)
+      start = r_time();
+  }
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +129,14 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->nacquire++;
+  if(spins){
+    start = r_time() - start;
+    lk->ncontend++;
+    lk->nspin += spins;
+    lk->wait += start;
+    recordwait((uint64)__builtin_return_address(0), lk->name, 0, start);
+  }
 }
 
 // Release the lock.
@@ -59,6 +156,7 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#ifdef SPINLOCK_TAS
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +165,11 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#else
+  // Serve the next ticket. Only the holder writes owner,
+  // so a plain load and a single atomic store suffice.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+#endif
 
   pop_off();
 }
@@ -77,7 +180,11 @@ int
 holding(struct spinlock *lk)
 {
   int r;
+#ifdef SPINLOCK_TAS
   r = (lk->locked && lk->cpu == mycpu());
+#else
+  r = (lk->next != lk->owner && lk->cpu == mycpu());
+#endif
   return r;
 }
 
@@ -108,3 +215,105 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy statistics for up to n of the locks that have been
+// acquired to the user array at addr. Returns the number
+// copied, or -1.
+int
+lockstat(uint64 addr, int n)
+{
+  struct spinlock *lk;
+  struct lockstat st;
+  int i, k = 0;
+
+  for(i = 0; i < NLOCK && k < n; i++){
+    // hold locklist.lock so that lk can't be freed, but
+    // not across copyout(), which may allocate.
+    acquire(&locklist.lock);
+    if((lk = locklist.lk[i]) == 0 || lk->nacquire == 0){
+      release(&locklist.lock);
+      continue;
+    }
+    safestrcpy(st.name, lk->name, sizeof(st.name));
+    st.nacquire = lk->nacquire;
+    st.ncontend = lk->ncontend;
+    st.nspin = lk->nspin;
+    st.wait = lk->wait;
+    release(&locklist.lock);
+    if(copyout(myproc()->pagetable, addr + k*sizeof(st), (char *)&st, sizeof(st)) < 0)
+      return -1;
+    k++;
+  }
+  return k;
+}
+
+static void
+lock_sites(void)
+{
+  push_off();
+  while(__sync_lock_test_and_set(&sites.lock, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+static void
+unlock_sites(void)
+{
+  __sync_lock_release(&sites.lock);
+  pop_off();
+}
+
+// Note that the caller at pc waited cycles of the time
+// counter for the lock called name.
+void
+recordwait(uint64 pc, char *name, int sleep, uint64 cycles)
+{
+  struct site *st;
+  int i;
+
+  lock_sites();
+  // a site that finds the table full is not recorded.
+  for(i = 0; i < NSITE; i++){
+    st = &sites.site[(pc / 4 + i) % NSITE];
+    if(st->pc == 0){
+      st->pc = pc;
+      st->name = name;
+      st->sleep = sleep;
+    }
+    if(st->pc == pc && st->name == name){
+      st->ncontend++;
+      st->wait += cycles;
+      break;
+    }
+  }
+  unlock_sites();
+}
+
+// Copy up to n of the sites that waited for a lock to the
+// user array at addr. Returns the number copied, or -1.
+int
+locksites(uint64 addr, int n)
+{
+  struct locksite ls;
+  struct site *st;
+  int i, k = 0;
+
+  for(i = 0; i < NSITE && k < n; i++){
+    st = &sites.site[i];
+    lock_sites();
+    ls.pc = st->pc;
+    if(ls.pc != 0){
+      safestrcpy(ls.name, st->name, sizeof(ls.name));
+      ls.sleep = st->sleep;
+      ls.ncontend = st->ncontend;
+      ls.wait = st->wait;
+    }
+    unlock_sites();
+    if(ls.pc == 0)
+      continue;
+    if(copyout(myproc()->pagetable, addr + k*sizeof(ls), (char *)&ls, sizeof(ls)) < 0)
+      return -1;
+    k++;
+  }
+  return k;
+}
@@ -1,9 +1,24 @@
 // Mutual exclusion lock.
+//
+// By default a ticket lock: acquire() takes the next ticket
+// and waits for owner to reach it, so harts get the lock in
+// the order they asked for it. Building with SPINLOCK=tas
+// selects the original test-and-set lock instead.
 struct spinlock {
+#ifdef SPINLOCK_TAS
   uint locked;       // Is the lock held?
+#else
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket now being served.
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
-};
 
+  // Statistics, updated while holding the lock:
+  uint64 nacquire;   // acquisitions
+  uint64 ncontend;   // acquisitions that had to wait
+  uint64 nspin;      // iterations spent waiting
+  uint64 wait;       // time counter cycles spent waiting
+};
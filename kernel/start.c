@@ -6,10 +6,17 @@
 
 void main();
 void timerinit();
+void ipiinit();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// a scratch area per CPU for machine-mode IPIs.
+uint64 ipiscratch[NCPU][3];
+
+// in kernelvec.S, forwards IPIs to supervisor mode.
+extern void machinevec();
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -40,6 +47,9 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // pass IPIs on to supervisor mode.
+  ipiinit();
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -62,5 +72,27 @@ timerinit()
   w_mcounteren(r_mcounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TICKCYCLES);
+}
+
+// arrange for IPIs from kick() to reach supervisor mode.
+// the CLINT can only send machine-mode software interrupts,
+// which cannot be delegated, so machinevec takes them and
+// raises a supervisor software interrupt instead.
+void
+ipiinit()
+{
+  int id = r_mhartid();
+
+  // scratch[0,8] : space for machinevec to save registers.
+  // scratch[16] : address of this hart's CLINT MSIP register.
+  uint64 *scratch = &ipiscratch[id][0];
+  scratch[2] = CLINT_MSIP(id);
+  w_mscratch((uint64)scratch);
+
+  // set the machine-mode trap handler.
+  w_mtvec((uint64)machinevec);
+
+  // enable machine-mode software interrupts.
+  w_mie(r_mie() | MIE_MSIE);
 }
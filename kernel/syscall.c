@@ -11,7 +11,7 @@
 int
 fetchaddr(uint64 addr, uint64 *ip)
 {
-  struct proc *p = myproc();
+  struct proc *p = myproc()->leader;
   if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
@@ -101,6 +101,23 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_getpstat(void);
+extern uint64 sys_sysinfo(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_uptime_ns(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_waitpid(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_locksites(void);
+extern uint64 sys_dropcache(void);
+extern uint64 sys_iostat(void);
+extern uint64 sys_iopoll(void);
+extern uint64 sys_fsync(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +143,23 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_setpriority] sys_setpriority,
+[SYS_getpstat] sys_getpstat,
+[SYS_sysinfo] sys_sysinfo,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_uptime_ns] sys_uptime_ns,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_waitpid] sys_waitpid,
+[SYS_lockstat] sys_lockstat,
+[SYS_locksites] sys_locksites,
+[SYS_dropcache] sys_dropcache,
+[SYS_iostat]  sys_iostat,
+[SYS_iopoll]  sys_iopoll,
+[SYS_fsync]   sys_fsync,
 };
 
 void
@@ -20,3 +20,20 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setpriority 22
+#define SYS_getpstat 23
+#define SYS_sysinfo 24
+#define SYS_nanosleep 25
+#define SYS_uptime_ns 26
+#define SYS_setaffinity 27
+#define SYS_clone 28
+#define SYS_join  29
+#define SYS_futex_wait 30
+#define SYS_futex_wake 31
+#define SYS_waitpid 32
+#define SYS_lockstat 33
+#define SYS_locksites 34
+#define SYS_dropcache 35
+#define SYS_iostat 36
+#define SYS_iopoll 37
+#define SYS_fsync  38
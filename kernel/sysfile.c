@@ -25,7 +25,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->leader->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -40,14 +40,18 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->leader;
 
+  // the process's threads share ofile[].
+  acquire(&p->tlock);
   for(fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd] == 0){
       p->ofile[fd] = f;
+      release(&p->tlock);
       return fd;
     }
   }
+  release(&p->tlock);
   return -1;
 }
 
@@ -99,10 +103,18 @@ sys_close(void)
 {
   int fd;
   struct file *f;
+  struct proc *p = myproc()->leader;
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // another thread may be closing fd too; only one takes f.
+  acquire(&p->tlock);
+  if(p->ofile[fd] != f){
+    release(&p->tlock);
+    return -1;
+  }
+  p->ofile[fd] = 0;
+  release(&p->tlock);
   fileclose(f);
   return 0;
 }
@@ -119,6 +131,20 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until the file's updates, and every other finished
+// update, are on disk. There is one log for the whole file
+// system, so this is the same for every file.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -410,8 +436,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct proc *p = myproc()->leader;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,9 +451,13 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
-  end_op();
+  // the process's threads share cwd.
+  acquire(&p->tlock);
+  old = p->cwd;
   p->cwd = ip;
+  release(&p->tlock);
+  iput(old);
+  end_op();
   return 0;
 }
 
@@ -480,7 +510,7 @@ sys_pipe(void)
   uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->leader;
 
   argaddr(0, &fdarray);
   if(pipealloc(&rf, &wf) < 0)
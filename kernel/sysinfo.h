@@ -0,0 +1,16 @@
+// System-wide statistics, returned by sysinfo().
+// Include kernel/param.h first, for NCPU.
+struct sysinfo {
+  uint ticks;               // clock ticks since boot
+  uint64 ntimer[NCPU];      // timer interrupts taken by each hart
+  uint64 ndevintr[NCPU];    // device interrupts taken by each hart
+  uint64 nipi[NCPU];        // IPIs taken by each hart
+  uint64 bhit;              // buffer cache lookups that hit
+  uint64 bmiss;             // and that missed
+  uint64 bra;               // blocks read ahead
+  uint64 balloc;            // blocks allocated
+  uint64 bscan;             // bitmap bits looked at to allocate them
+  uint64 bscanread;         // bitmap blocks read to allocate them
+  uint nbuf;                // buffers in the cache
+  uint maxbuf;              // most it may grow to
+};
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sysinfo.h"
 
 uint64
 sys_exit(void)
@@ -27,6 +28,28 @@ sys_fork(void)
   return fork();
 }
 
+// create a thread in this process.
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+// wait for a thread of this process to exit.
+uint64
+sys_join(void)
+{
+  int tid;
+
+  argint(0, &tid);
+  return join(tid);
+}
+
 uint64
 sys_wait(void)
 {
@@ -35,39 +58,56 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_waitpid(void)
+{
+  int pid, options;
+  uint64 p;
+
+  argint(0, &pid);
+  argaddr(1, &p);
+  argint(2, &options);
+  return waitpid(pid, p, options);
+}
+
 uint64
 sys_sbrk(void)
 {
-  uint64 addr;
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
+// sleep for n ticks.
 uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepuntil(r_time() + (uint64)n*TICKCYCLES);
+}
+
+// the latest deadline nanosleep() asks for: thousands of
+// years away, and far enough from 2^64 not to overflow.
+#define MAXDEADLINE (~0ULL >> 1)
+
+// sleep for at least ns nanoseconds.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns, cycles, now;
+
+  argaddr(0, &ns);
+  // round up without overflowing.
+  cycles = ns / NSPERCYCLE + (ns % NSPERCYCLE != 0);
+  now = r_time();
+  if(cycles > MAXDEADLINE - now)
+    return sleepuntil(MAXDEADLINE);
+  return sleepuntil(now + cycles);
 }
 
 uint64
@@ -87,7 +127,152 @@ sys_uptime(void)
   uint xticks;
 
   acquire(&tickslock);
+  tickupdate();
   xticks = ticks;
   release(&tickslock);
   return xticks;
 }
+
+// return nanoseconds since boot, from the time counter.
+uint64
+sys_uptime_ns(void)
+{
+  return r_time() * NSPERCYCLE;
+}
+
+// set the base scheduling priority of a process.
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  argint(0, &pid);
+  argint(1, &prio);
+  return setpriority(pid, prio);
+}
+
+// restrict a process to a set of cpus.
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  argint(0, &pid);
+  argint(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+// sleep while the user word at addr holds val.
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futex_wait(addr, val);
+}
+
+// wake up to n sleepers on the user word at addr.
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futex_wake(addr, n);
+}
+
+// copy a process's scheduling statistics to user space.
+uint64
+sys_getpstat(void)
+{
+  int pid;
+  uint64 addr;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  return getpstat(pid, addr);
+}
+
+// copy system-wide statistics to user space.
+uint64
+sys_sysinfo(void)
+{
+  uint64 addr;
+  struct sysinfo info;
+  int i;
+
+  argaddr(0, &addr);
+  memset(&info, 0, sizeof(info));
+  acquire(&tickslock);
+  tickupdate();
+  info.ticks = ticks;
+  release(&tickslock);
+  for(i = 0; i < NCPU; i++){
+    info.ntimer[i] = cpus[i].ntimer;
+    info.ndevintr[i] = cpus[i].ndevintr;
+    info.nipi[i] = cpus[i].nipi;
+  }
+  bcachestat(&info);
+  ballocstat(&info);
+  return copyout(myproc()->pagetable, addr, (char *)&info, sizeof(info));
+}
+
+// copy per-lock statistics to user space.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return lockstat(addr, n);
+}
+
+// copy the lock call sites that waited to user space.
+uint64
+sys_locksites(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return locksites(addr, n);
+}
+
+// drop the unused blocks from the buffer cache, so that
+// benchmarks can measure reads from the disk. commits
+// first, since blocks waiting for a commit can't be dropped.
+uint64
+sys_dropcache(void)
+{
+  log_sync();
+  return bdrop();
+}
+
+// copy the disk I/O statistics to user space.
+uint64
+sys_iostat(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return iostat(addr);
+}
+
+// set how long waits for a class of disk request poll.
+uint64
+sys_iopoll(void)
+{
+  int class, us;
+
+  argint(0, &class);
+  argint(1, &us);
+  return iopoll(class, us);
+}
@@ -0,0 +1,281 @@
+// Timer wheel for sleeping processes.
+//
+// A process that sleeps for a fixed time waits on a struct
+// timer, filed in a hierarchical timing wheel indexed by the
+// time counter (r_time()). Time is divided into jiffies of
+// 1<<JIFFYSHIFT cycles. Level 0 of the wheel has one slot per
+// jiffy for the next NSLOT jiffies; each slot of level k covers
+// NSLOT slots of level k-1. A timer is filed in the lowest
+// level whose range reaches its expiry. When the wheel reaches
+// the start of a slot in a higher level, that slot's timers are
+// cascaded into the levels below, so timers only ever fire from
+// level 0: each one fires within a jiffy after its expiry, and
+// firing wakes just the process that owns it, or whatever is
+// sleeping on the channel it was given.
+//
+// clockintr() calls wheelrun() when wheelnext() says some
+// timer may be due, and clockset() asks for a timer interrupt
+// no later than wheelnext().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define JIFFYSHIFT 8              // 256 cycles, about 25us
+#define SLOTBITS   6
+#define NSLOT      (1 << SLOTBITS)
+#define LEVELS     4              // reaches 2^32 cycles, about 7 minutes
+#define NOEVENT    (~0ULL)
+
+struct timer {
+  uint64 expires;          // r_time() value at which to fire
+  int fired;               // set by wheelrun()
+  void *chan;              // what to wake up when it fires
+  int level;               // where the timer is filed
+  int slot;
+  struct timer *next;      // slot list
+  struct timer **pprev;
+};
+
+struct {
+  struct spinlock lock;
+  uint64 clk;              // next jiffy to process
+  uint64 next;             // r_time() of the next event, or NOEVENT
+  uint64 occupied[LEVELS]; // bitmap of non-empty slots
+  struct timer *slot[LEVELS][NSLOT];
+} wheel;
+
+void
+wheelinit(void)
+{
+  initlock(&wheel.lock, "wheel");
+  wheel.clk = r_time() >> JIFFYSHIFT;
+  wheel.next = NOEVENT;
+}
+
+// Add t to the list for a slot.
+static void
+slotinsert(struct timer *t, int level, int slot)
+{
+  struct timer **head = &wheel.slot[level][slot];
+
+  t->level = level;
+  t->slot = slot;
+  t->next = *head;
+  if(*head)
+    (*head)->pprev = &t->next;
+  *head = t;
+  t->pprev = head;
+  wheel.occupied[level] |= 1ULL << slot;
+}
+
+// Remove t from its slot's list.
+static void
+slotremove(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  if(wheel.slot[t->level][t->slot] == 0)
+    wheel.occupied[t->level] &= ~(1ULL << t->slot);
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// File t in the lowest level whose range covers its expiry.
+// A timer that has already expired goes in the current
+// level 0 slot; one beyond the wheel's reach is parked in
+// the last slot of the top level and re-filed when that
+// slot is cascaded.
+static void
+enqueue(struct timer *t)
+{
+  // round up, so that t never fires early.
+  uint64 j = (t->expires + (1 << JIFFYSHIFT) - 1) >> JIFFYSHIFT;
+  uint64 delta;
+  int level;
+
+  if(j < wheel.clk)
+    j = wheel.clk;
+  delta = j - wheel.clk;
+  if(delta >= 1ULL << (SLOTBITS*LEVELS)){
+    j = wheel.clk + (1ULL << (SLOTBITS*LEVELS)) - 1;
+    delta = j - wheel.clk;
+  }
+  for(level = 0; level < LEVELS-1; level++)
+    if(delta < 1ULL << (SLOTBITS*(level+1)))
+      break;
+  slotinsert(t, level, (j >> (SLOTBITS*level)) & (NSLOT-1));
+}
+
+// The first jiffy at or after wheel.clk at which the wheel
+// has work to do: a level 0 slot to fire, or a higher-level
+// slot to cascade. NOEVENT if the wheel is empty.
+static uint64
+nextevent(void)
+{
+  uint64 first = NOEVENT, base, n;
+  int level, shift, i;
+
+  for(level = 0; level < LEVELS; level++){
+    if(wheel.occupied[level] == 0)
+      continue;
+    // the first slot of this level that the wheel has not
+    // yet started: the current one if clk is exactly at its
+    // start, otherwise the one after it.
+    shift = SLOTBITS*level;
+    base = (wheel.clk + (1ULL << shift) - 1) >> shift;
+    for(i = 0; i < NSLOT; i++){
+      n = base + i;
+      if(wheel.occupied[level] & (1ULL << (n & (NSLOT-1)))){
+        if((n << shift) < first)
+          first = n << shift;
+        break;
+      }
+    }
+  }
+  return first;
+}
+
+// Fire every timer due by time now, cascading the
+// higher-level slots whose start has been reached.
+// Caller must hold wheel.lock.
+static void
+run(uint64 now)
+{
+  uint64 target = now >> JIFFYSHIFT;
+  uint64 j;
+  struct timer *t, *list;
+  int level, shift, slot;
+
+  // jump straight from one event to the next; the slots
+  // in between are empty.
+  while((j = nextevent()) <= target){
+    wheel.clk = j;
+
+    // cascade from the top down, so that timers moving
+    // into a slot that is also starting now get cascaded
+    // again on the way down.
+    for(level = LEVELS-1; level > 0; level--){
+      shift = SLOTBITS*level;
+      if((j & ((1ULL << shift) - 1)) != 0)
+        continue;
+      slot = (j >> shift) & (NSLOT-1);
+      list = wheel.slot[level][slot];
+      wheel.slot[level][slot] = 0;
+      wheel.occupied[level] &= ~(1ULL << slot);
+      while((t = list) != 0){
+        list = t->next;
+        enqueue(t);
+      }
+    }
+
+    slot = j & (NSLOT-1);
+    while((t = wheel.slot[0][slot]) != 0){
+      slotremove(t);
+      t->fired = 1;
+      wakeup(t->chan);
+    }
+    wheel.clk = j + 1;
+  }
+  if(wheel.clk <= target)
+    wheel.clk = target + 1;
+
+  j = nextevent();
+  wheel.next = (j == NOEVENT) ? NOEVENT : j << JIFFYSHIFT;
+}
+
+// Fire the timers that have expired.
+void
+wheelrun(void)
+{
+  acquire(&wheel.lock);
+  run(r_time());
+  release(&wheel.lock);
+}
+
+// The time counter value by which wheelrun() should next
+// be called. Read without the lock: a stale value only
+// costs an early or extra timer interrupt, because the
+// hart that adds a timer reprograms its own timer.
+uint64
+wheelnext(void)
+{
+  return wheel.next;
+}
+
+// Sleep until the time counter reaches deadline.
+// Returns 0, or -1 if the process was killed first.
+int
+sleepuntil(uint64 deadline)
+{
+  struct timer t;
+  int r = 0;
+
+  if(r_time() >= deadline)
+    return 0;
+
+  t.expires = deadline;
+  t.fired = 0;
+  t.chan = &t;
+
+  acquire(&wheel.lock);
+
+  // catch the wheel up first, so that t is filed
+  // relative to the current time.
+  run(r_time());
+  enqueue(&t);
+  if(deadline < wheel.next)
+    wheel.next = deadline;
+
+  // make sure this hart's timer goes off in time;
+  // interrupts are off while wheel.lock is held.
+  clockset();
+
+  while(!t.fired){
+    if(killed(myproc())){
+      slotremove(&t);
+      r = -1;
+      break;
+    }
+    sleep(&t, &wheel.lock);
+  }
+  release(&wheel.lock);
+  return r;
+}
+
+// Like sleep(chan, lk), but also wake up once the time
+// counter reaches deadline. Caller must hold lk, and must
+// check again why it woke up, as with sleep().
+void
+sleeptimeout(void *chan, struct spinlock *lk, uint64 deadline)
+{
+  struct timer t;
+
+  if(r_time() >= deadline)
+    return;
+
+  t.expires = deadline;
+  t.fired = 0;
+  t.chan = chan;
+
+  acquire(&wheel.lock);
+  run(r_time());
+  enqueue(&t);
+  if(deadline < wheel.next)
+    wheel.next = deadline;
+  clockset();
+
+  // firing wakes chan while holding wheel.lock, so release
+  // it only once this process is on chan's wait queue.
+  sleep2(chan, lk, &wheel.lock);
+
+  acquire(&wheel.lock);
+  if(!t.fired)
+    slotremove(&t);
+  release(&wheel.lock);
+}
@@ -9,6 +9,11 @@
 struct spinlock tickslock;
 uint ticks;
 
+// ticks counts TICKCYCLES periods of the time counter since
+// tickbase, rather than timer interrupts, because idle harts
+// skip the interrupts they do not need.
+static uint64 tickbase;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -20,6 +25,7 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  tickbase = r_time();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -45,6 +51,9 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // back in the kernel. see tlbshootdown().
+  __sync_fetch_and_add(&mycpu()->ugen, 1);
+
   struct proc *p = myproc();
   
   // save user program counter.
@@ -80,8 +89,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this timer interrupt ends
+  // the process's quantum.
+  if(which_dev == 2 && schedtick())
     yield();
 
   usertrapret();
@@ -126,11 +136,16 @@ usertrapret(void)
   // tell trampoline.S the user page table to switch to.
   uint64 satp = MAKE_SATP(p->pagetable);
 
+  // userret flushes the TLB, so this CPU no longer needs
+  // to be told about changes to user page tables made
+  // while it was in the kernel. see tlbshootdown().
+  __sync_fetch_and_add(&mycpu()->ugen, 1);
+
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, THREADFRAME(p->tfslot));
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -154,8 +169,9 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0)
+  // give up the CPU if this timer interrupt ends
+  // the process's quantum.
+  if(which_dev == 2 && myproc() != 0 && schedtick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -164,26 +180,74 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the time counter.
+// Caller must hold tickslock.
 void
+tickupdate(void)
+{
+  ticks = (r_time() - tickbase) / TICKCYCLES;
+}
+
+// Ask for this hart's next timer interrupt, which also
+// clears the current interrupt request.
+// A hart that is running a process needs an interrupt
+// every tick, to charge the process for its quantum.
+// An idle hart only needs to wake for work it can't be
+// told about otherwise: new processes reach it through a
+// device interrupt or an IPI from kick().
+// Either way, the interrupt comes no later than the next
+// timer in the timer wheel.
+void
+clockset(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  uint64 next;
+
+  if(c->proc){
+    if(c->tickless || now >= c->nexttick)
+      c->nexttick = now + TICKCYCLES;
+    next = c->nexttick;
+    c->tickless = 0;
+  } else {
+    next = now + IDLETICKS*TICKCYCLES;
+    c->tickless = 1;
+  }
+  if(wheelnext() < next)
+    next = wheelnext();
+  w_stimecmp(next);
+}
+
+// returns 1 if this interrupt ends a tick of the
+// running process, 0 if it was only for the timer wheel.
+int
 clockintr()
 {
-  if(cpuid() == 0){
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  int tick;
+
+  tick = c->proc != 0 && !c->tickless && now >= c->nexttick;
+
+  // any hart may advance ticks, since an idle hart
+  // no longer takes an interrupt every tick.
+  if((now - tickbase) / TICKCYCLES != ticks){
     acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
+    tickupdate();
     release(&tickslock);
   }
 
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  if(now >= wheelnext())
+    wheelrun();
+
+  clockset();
+  return tick;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if a timer interrupt that ends a tick,
+// 1 if other device or timer wheel interrupt,
 // 0 if not recognized.
 int
 devintr()
@@ -196,6 +260,8 @@ devintr()
     // irq indicates which device interrupted.
     int irq = plic_claim();
 
+    mycpu()->ndevintr++;
+
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
@@ -213,8 +279,15 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000005L){
     // timer interrupt.
-    clockintr();
-    return 2;
+    mycpu()->ntimer++;
+    return clockintr() ? 2 : 1;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt: an IPI from kick(), forwarded
+    // by machinevec. all it needs to do is wake this
+    // hart so that the scheduler looks for work.
+    mycpu()->nipi++;
+    w_sip(r_sip() & ~2);
+    return 1;
   } else {
     return 0;
   }
@@ -45,9 +45,11 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// the most virtio descriptors the driver uses.
+// must be a power of two, and at most 256, so that each
+// ring fits in a page. virtio_disk_init() uses fewer if
+// the device's queue is shorter.
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -64,7 +66,7 @@ struct virtq_avail {
   uint16 flags; // always zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with VIRTIO_RING_F_EVENT_IDX; see below
 };
 
 // one entry in the "used" ring, with which the
@@ -78,8 +80,16 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with VIRTIO_RING_F_EVENT_IDX; see below
 };
 
+// with VIRTIO_RING_F_EVENT_IDX, the driver sets used_event to
+// ask for an interrupt once the used idx passes it, and the
+// device sets avail_event to ask for a notify once the avail
+// idx passes it. both sit just after the ring, so for a queue
+// shorter than NUM they are at ring[queue size], not at the
+// fields above.
+
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
 
@@ -15,6 +15,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "iostat.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -39,15 +40,27 @@ static struct disk {
   struct virtq_used *used;
 
   // our own book-keeping.
+  int num;         // queue size, at most NUM
+  int nfree;       // number of free descriptors
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int event_idx;   // VIRTIO_RING_F_EVENT_IDX negotiated?
+  volatile uint16 *used_event;  // see virtio.h
+  volatile uint16 *avail_event;
+
+  // statistics, for iostat().
+  uint64 nintr;    // interrupts
+  uint64 nidle;    // interrupts that found nothing to do
+  uint64 nkick;    // notifies sent to the device
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // status and done are indexed by the first descriptor
+  // index of the chain, b by each data descriptor's index.
   struct {
     struct buf *b;
     char status;
+    void (*done)(struct buf *); // called on completion, if set
   } info[NUM];
 
   // disk command headers.
@@ -90,9 +103,9 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.event_idx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -114,7 +127,10 @@ virtio_disk_init(void)
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
-  if(max < NUM)
+  // use the largest power of two that both allow.
+  for(disk.num = NUM; disk.num > max; disk.num /= 2)
+    ;
+  if(disk.num < MAXSEG + 2)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
@@ -128,7 +144,9 @@ virtio_disk_init(void)
   memset(disk.used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
+  disk.used_event = &disk.avail->ring[disk.num];
+  disk.avail_event = (uint16 *) &disk.used->ring[disk.num];
 
   // write physical addresses.
   *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
@@ -141,9 +159,10 @@ virtio_disk_init(void)
   // queue is ready.
   *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
+  // all descriptors start out unused.
+  for(int i = 0; i < disk.num; i++)
     disk.free[i] = 1;
+  disk.nfree = disk.num;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -156,9 +175,10 @@ virtio_disk_init(void)
 static int
 alloc_desc()
 {
-  for(int i = 0; i < NUM; i++){
+  for(int i = 0; i < disk.num; i++){
     if(disk.free[i]){
       disk.free[i] = 0;
+      disk.nfree--;
       return i;
     }
   }
@@ -169,7 +189,7 @@ alloc_desc()
 static void
 free_desc(int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("free_desc 1");
   if(disk.free[i])
     panic("free_desc 2");
@@ -178,6 +198,7 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
+  disk.nfree++;
   wakeup(&disk.free[0]);
 }
 
@@ -196,12 +217,13 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  if(disk.nfree < n)
+    return -1;
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +234,34 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// does moving an index from old to new pass event?
+// from the virtio spec's vring_need_event().
+static int
+need_event(uint16 event, uint16 new, uint16 old)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  return (uint16)(new - event - 1) < (uint16)(new - old);
+}
 
-  acquire(&disk.vdisk_lock);
+// start a transfer between the n buffers in b[] and
+// consecutive blocks of the disk, starting at b[0]->qblock.
+// returns the index of the first descriptor, or -1 if
+// there are not enough free descriptors.
+// caller must hold disk.vdisk_lock.
+static int
+submit(struct buf **b, int n, int write, void (*done)(struct buf *))
+{
+  uint64 sector = b[0]->qblock * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a chain of descriptors: one for type/reserved/sector, one for
+  // each piece of the data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+  // allocate the descriptors.
+  int idx[MAXSEG+2];
+  if(allocn_desc(idx, n+2) != 0)
+    return -1;
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,46 +278,137 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) b[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+
+    // record struct buf for virtio_disk_intr().
+    b[i-1]->disk = 1;
+    disk.info[idx[i]].b = b[i-1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].done = done;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % disk.num] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
+  uint16 old = disk.avail->idx;
   disk.avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
-
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  // a device that is still working through the avail ring
+  // will see the new entry without being told.
+  if(!disk.event_idx || need_event(*disk.avail_event, disk.avail->idx, old)){
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+    disk.nkick++;
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  return idx[0];
+}
+
+// Start a transfer between the n locked buffers in b[] and
+// consecutive disk blocks, starting at b[0]->qblock, as a
+// single request, and return without waiting for it to
+// finish. n is at most MAXSEG. When the transfer finishes,
+// virtio_disk_intr() calls done() for each buffer if done
+// is not 0, which must clear b->disk; otherwise it clears
+// b->disk and wakes up b. The I/O scheduler passes a done
+// function and does its own waiting. Many transfers
+// may be in flight at once. If the queue is full, sleeps
+// until it isn't, or returns -1 without starting anything
+// if nowait is set. Returns 0 once the transfer has started.
+int
+virtio_disk_startv(struct buf **b, int n, int write, void (*done)(struct buf *), int nowait)
+{
+  if(n < 1 || n > MAXSEG)
+    panic("virtio_disk_startv");
+  for(int i = 1; i < n; i++)
+    if(b[i]->dev != b[0]->dev || b[i]->qblock != b[0]->qblock + i)
+      panic("virtio_disk_startv: not contiguous");
 
+  acquire(&disk.vdisk_lock);
+  while(submit(b, n, write, done) < 0){
+    if(nowait){
+      release(&disk.vdisk_lock);
+      return -1;
+    }
+    sleep(&disk.free[0], &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
+  return 0;
+}
+
+// finish the requests the device has put in the used ring.
+// returns how many there were.
+// caller must hold disk.vdisk_lock.
+static int
+drain(void)
+{
+  int n = 0;
+
+  // with event idx, used_event still holds the used idx from
+  // the last time drain() finished, so the device doesn't
+  // interrupt again for requests that complete while this
+  // loop is already taking them off the ring.
+again:
+  // the device increments disk.used->idx when it
+  // adds an entry to the used ring.
+
+  while(disk.used_idx != disk.used->idx){
+    n++;
+    __sync_synchronize();
+    int id = disk.used->ring[disk.used_idx % disk.num].id;
+
+    if(disk.info[id].status != 0)
+      panic("virtio_disk_intr status");
+
+    // collect the bufs from the data descriptors, which
+    // are all but the first and last of the chain.
+    struct buf *b[MAXSEG];
+    int nb = 0;
+    for(int i = disk.desc[id].next; disk.desc[i].flags & VRING_DESC_F_NEXT; i = disk.desc[i].next){
+      b[nb++] = disk.info[i].b;
+      disk.info[i].b = 0;
+    }
+    void (*done)(struct buf *) = disk.info[id].done;
+    free_chain(id);
+    for(int i = 0; i < nb; i++){
+      if(done){
+        done(b[i]);   // done() clears b->disk
+      } else {
+        b[i]->disk = 0;   // disk is done with buf
+        wakeup(b[i]);
+      }
+    }
+
+    disk.used_idx += 1;
+  }
+
+  if(disk.event_idx){
+    // ask for an interrupt at the next completion, then look
+    // again, in case it came before the device saw the request.
+    *disk.used_event = disk.used_idx;
+    __sync_synchronize();
+    if(disk.used_idx != disk.used->idx)
+      goto again;
+  }
+  return n;
 }
 
 void
@@ -306,22 +426,37 @@ virtio_disk_intr()
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+  disk.nintr++;
+  if(drain() == 0)
+    disk.nidle++;
 
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
+  release(&disk.vdisk_lock);
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+  // descriptors are free, so queued requests can start.
+  iosched_kick();
+}
 
-    disk.used_idx += 1;
-  }
+// Finish whatever requests the device has completed, without
+// waiting for its interrupt. For a process that polls rather
+// than sleeping until its request is done. The interrupt
+// still arrives, and finds less or nothing to do.
+void
+virtio_disk_poll(void)
+{
+  acquire(&disk.vdisk_lock);
+  __sync_synchronize();
+  drain();
+  release(&disk.vdisk_lock);
+  iosched_kick();
+}
 
+// Add the driver's counters to st.
+void
+virtio_disk_stat(struct iostat *st)
+{
+  acquire(&disk.vdisk_lock);
+  st->nintr = disk.nintr;
+  st->nidle = disk.nidle;
+  st->nkick = disk.nkick;
   release(&disk.vdisk_lock);
 }
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -15,6 +16,37 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// serialize changes to the user PTEs of a page table that
+// the threads of a process share: COW faults, fork, and
+// shrinking sbrk(). hashed by page table.
+#define NCOWLOCK 13
+static struct spinlock cowlock[NCOWLOCK];
+
+static struct spinlock*
+cowlockof(pagetable_t pagetable)
+{
+  return &cowlock[((uint64)pagetable >> PGSHIFT) % NCOWLOCK];
+}
+
+// pages unmapped at a time before they are freed.
+#define NFREEBATCH 16
+
+// Free the n pages at pa[], just unmapped from pagetable. Other
+// threads may still have them in their TLBs, so shoot those
+// down first. Safe with a spinlock held: tlbshootdown() only
+// waits for CPUs that are in user space.
+static void
+freebatch(pagetable_t pagetable, uint64 *pa, int n)
+{
+  int i;
+
+  if(n == 0)
+    return;
+  tlbshootdown(pagetable);
+  for(i = 0; i < n; i++)
+    kfree((void*)pa[i]);
+}
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -27,6 +59,9 @@ kvmmake(void)
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, for sending IPIs with kick()
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
@@ -53,7 +88,11 @@ kvmmake(void)
 void
 kvminit(void)
 {
+  int i;
+
   kernel_pagetable = kvmmake();
+  for(i = 0; i < NCOWLOCK; i++)
+    initlock(&cowlock[i], "cow");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -177,8 +216,9 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, pa[NFREEBATCH];
   pte_t *pte;
+  int n = 0;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
@@ -190,12 +230,15 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
+    if(do_free)
+      pa[n++] = PTE2PA(*pte);
     *pte = 0;
+    if(n == NFREEBATCH){
+      freebatch(pagetable, pa, n);
+      n = 0;
+    }
   }
+  freebatch(pagetable, pa, n);
 }
 
 // create an empty user page table.
@@ -267,7 +310,9 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
+    acquire(cowlockof(pagetable));  // against uvmcow() in other threads
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    release(cowlockof(pagetable));
   }
 
   return newsz;
@@ -315,6 +360,8 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   uint64 pa, i;
   uint flags;
 
+  // the parent's other threads may be breaking COW pages.
+  acquire(cowlockof(old));
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
       panic("uvmcopy: pte should exist");
@@ -341,9 +388,11 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 
     krefer((void *)pa);
   }
+  release(cowlockof(old));
   return 0;
 
  err:
+  release(cowlockof(old));
   uvmunmap(new, 0, i / PGSIZE, 1);
   return -1;
 }
@@ -469,24 +518,41 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
 // Copies some pages in given page table then free the old pages
 // only used in cow strategy
+// Threads that share a page table may fault on the same page
+// at once, so the copying is done under a lock for the page
+// table, and a page that another thread has already copied
+// is left alone.
 int
 uvmcow(pagetable_t pagetable, uint64 va, uint64 npages)
 {
+  struct spinlock *lk;
+  uint64 old[NFREEBATCH];
+  int r = 0, n = 0;
+
   if (va >= MAXVA)
     return -1;
 
   va = PGROUNDDOWN(va);
+  lk = cowlockof(pagetable);
 
+  acquire(lk);
   for (uint64 a = va; a < va + npages * PGSIZE; a += PGSIZE){
-    pte_t *pte = walk(pagetable, va, 0);
+    pte_t *pte = walk(pagetable, a, 0);
 
-    if (pte == 0)
-      goto err;
+    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0){
+      r = -1;
+      break;
+    }
 
     int flags = PTE_FLAGS(*pte);
 
-    if ((flags & PTE_V) == 0 || (flags & PTE_U) == 0 || (flags & PTE_COW) == 0)
-      goto err;
+    if ((flags & PTE_COW) == 0){
+      // another thread got here first.
+      if (flags & PTE_W)
+        continue;
+      r = -1;
+      break;
+    }
 
     // remove cow flag and set writable if cow is set
     flags &= ~PTE_COW;
@@ -494,24 +560,28 @@ uvmcow(pagetable_t pagetable, uint64 va, uint64 npages)
 
     void *mem = kalloc();
 
-    if (mem == 0)
-      goto err;
-
-    // do we need to check cow bit? no side effect even though to copy a page that is not cow page
-    memmove(mem, (void *)PTE2PA(*pte), PGSIZE);
+    if (mem == 0){
+      r = -1;
+      break;
+    }
 
-    // old page will be freed here
-    uvmunmap(pagetable, va, 1, 1);
+    old[n] = PTE2PA(*pte);
+    memmove(mem, (void *)old[n], PGSIZE);
 
-    if (mappages(pagetable, a, PGSIZE, (uint64)mem, flags) < 0)
-      goto err;
+    // switch the pte over in place, so that other threads
+    // never see the page unmapped; the old page is freed
+    // once no TLB still maps it.
+    *pte = PA2PTE(mem) | flags;
+    if (++n == NFREEBATCH){
+      freebatch(pagetable, old, n);
+      n = 0;
+    }
   }
+  freebatch(pagetable, old, n);
+  release(lk);
 
-  return 0;
-
-err:
   // any page successfully copied will work correctly even though some other failed.
   // so no need to recovery copied pages
   // how to handle this error is up to the caller
-  return -1;
-}
\ No newline at end of file
+  return r;
+}
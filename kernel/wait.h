@@ -0,0 +1 @@
+#define WNOHANG 1  // waitpid(): return 0 instead of waiting
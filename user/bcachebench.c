@@ -0,0 +1,118 @@
+// Parallel read benchmark for the buffer cache.
+// One process per hart, each pinned to its hart, repeatedly
+// opens and reads its own small file. The files fit in the
+// cache, so after the first pass every bread() is a hit and
+// the time goes to looking blocks up. Runs once on a single
+// hart and then on all harts, to show how reads scale.
+//
+//   bcachebench [iterations-per-process]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define ITERS 300
+#define NBLK  2
+
+int iters = ITERS;
+char buf[BSIZE];
+
+void
+mkname(char *name, int i)
+{
+  strcpy(name, "bcb0");
+  name[3] = '0' + i;
+}
+
+void
+reader(int i)
+{
+  char name[8];
+  int n, fd;
+
+  setaffinity(getpid(), 1 << i);
+  mkname(name, i);
+  for(n = 0; n < iters; n++){
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("bcachebench: open %s failed\n", name);
+      exit(1);
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  exit(0);
+}
+
+// run readers on harts 0..nhart-1 and return the elapsed ns.
+uint64
+run(int nhart)
+{
+  uint64 t0;
+  int i, pid;
+
+  t0 = uptime_ns();
+  for(i = 0; i < nhart; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("bcachebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      reader(i);
+  }
+  for(i = 0; i < nhart; i++)
+    wait(0);
+  return uptime_ns() - t0;
+}
+
+void
+report(int nhart, uint64 ns)
+{
+  uint64 ops = (uint64)nhart * iters;
+
+  printf("bcachebench: %d harts, %lu opens+reads in %lu us, %lu ns each, %lu per second\n",
+         nhart, ops, ns / 1000, ns / ops, ops * 1000000000 / ns);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sysinfo info;
+  char name[8];
+  int i, j, fd, nhart;
+
+  if(argc > 1)
+    iters = atoi(argv[1]);
+
+  sysinfo(&info);
+  nhart = 0;
+  for(i = 0; i < NCPU; i++)
+    if(info.ntimer[i] != 0)
+      nhart++;
+
+  memset(buf, 'b', sizeof(buf));
+  for(i = 0; i < nhart; i++){
+    mkname(name, i);
+    if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+      printf("bcachebench: create %s failed\n", name);
+      exit(1);
+    }
+    for(j = 0; j < NBLK; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  report(1, run(1));
+  if(nhart > 1)
+    report(nhart, run(nhart));
+
+  for(i = 0; i < nhart; i++){
+    mkname(name, i);
+    unlink(name);
+  }
+  exit(0);
+}
@@ -0,0 +1,96 @@
+// File creation benchmark. Each of several processes
+// repeatedly creates a small file, writes it, and deletes it,
+// each step its own transaction. Runs with one process and
+// then with several, to show how well concurrent system calls
+// share log commits. Also reports how many bits of the free
+// bitmap balloc() looked at for each block it allocated.
+//
+//   createbench [files-per-process [processes]]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NCREATE 50
+#define NCREATOR 4
+
+int nfile = NCREATE;
+char buf[100];
+
+void
+creator(int i)
+{
+  char name[8];
+  int n, fd;
+
+  strcpy(name, "cb00");
+  name[2] = 'a' + i;
+  for(n = 0; n < nfile; n++){
+    name[3] = '0' + n % 10;
+    if((fd = open(name, O_CREATE | O_WRONLY)) < 0){
+      printf("createbench: create %s failed\n", name);
+      exit(1);
+    }
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("createbench: write failed\n");
+      exit(1);
+    }
+    close(fd);
+    unlink(name);
+  }
+  exit(0);
+}
+
+void
+run(int nproc)
+{
+  struct sysinfo before, after;
+  uint64 t0, ns, ops, nalloc;
+  int i, pid;
+
+  sysinfo(&before);
+  t0 = uptime_ns();
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("createbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      creator(i);
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  ns = uptime_ns() - t0;
+  sysinfo(&after);
+
+  ops = (uint64)nproc * nfile;
+  printf("createbench: %d procs, %lu files in %lu us, %lu per second\n",
+         nproc, ops, ns / 1000, ops * 1000000000 / ns);
+  nalloc = after.balloc - before.balloc;
+  if(nalloc > 0)
+    printf("createbench: %lu blocks allocated, %lu bitmap bits and %lu bitmap blocks read per 100\n",
+           nalloc, (after.bscan - before.bscan) * 100 / nalloc,
+           (after.bscanread - before.bscanread) * 100 / nalloc);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = NCREATOR;
+
+  if(argc > 1)
+    nfile = atoi(argv[1]);
+  if(argc > 2)
+    nproc = atoi(argv[2]);
+  if(nproc > 26)
+    nproc = 26;
+
+  memset(buf, 'c', sizeof(buf));
+  run(1);
+  if(nproc > 1)
+    run(nproc);
+  exit(0);
+}
@@ -0,0 +1,146 @@
+// Compare a spinning mutex with a futex-based one.
+// NWORKER threads (more than there are harts, so lock
+// holders get preempted) each increment a shared counter
+// under the mutex, with a little work inside and outside
+// the critical section. Reports the elapsed time and how
+// much CPU time the threads burned, from getpstat().
+//
+//   futexbench [iterations-per-thread]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/pstat.h"
+#include "user/user.h"
+
+#define NWORKER 6
+#define ITERS   2000
+#define STACK   4096
+
+// a mutex word: 0 unlocked, 1 locked, 2 locked with
+// possible waiters (see Drepper, "Futexes Are Tricky").
+struct mutex {
+  int word;
+};
+
+int usefutex;
+int iters = ITERS;
+struct mutex m;
+volatile uint64 counter;
+char stacks[NWORKER][STACK];
+uint64 cputime[NWORKER];
+
+void
+spinlock(struct mutex *mu)
+{
+  while(__sync_lock_test_and_set(&mu->word, 1) != 0)
+    ;
+}
+
+void
+spinunlock(struct mutex *mu)
+{
+  __sync_lock_release(&mu->word);
+}
+
+void
+futexlock(struct mutex *mu)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&mu->word, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&mu->word, 2);
+  while(c != 0){
+    futex_wait(&mu->word, 2);
+    c = __sync_lock_test_and_set(&mu->word, 2);
+  }
+}
+
+void
+futexunlock(struct mutex *mu)
+{
+  if(__sync_fetch_and_sub(&mu->word, 1) != 1){
+    __sync_lock_release(&mu->word);
+    futex_wake(&mu->word, 1);
+  }
+}
+
+void
+work(int n)
+{
+  volatile int i;
+
+  for(i = 0; i < n; i++)
+    ;
+}
+
+void
+worker(void *arg)
+{
+  struct pstat st;
+  int i;
+
+  for(i = 0; i < iters; i++){
+    if(usefutex)
+      futexlock(&m);
+    else
+      spinlock(&m);
+    counter++;
+    work(200);
+    if(usefutex)
+      futexunlock(&m);
+    else
+      spinunlock(&m);
+    work(200);
+  }
+  if(getpstat(getpid(), &st) == 0)
+    cputime[(uint64)arg] = st.rtime;
+  exit(0);
+}
+
+// run the workers, returning elapsed ns and setting
+// *cpu to the cycles they spent running.
+uint64
+run(uint64 *cpu)
+{
+  int i;
+  uint64 t0, t1;
+
+  counter = 0;
+  m.word = 0;
+  t0 = uptime_ns();
+  for(i = 0; i < NWORKER; i++){
+    if(clone(worker, (void *)(uint64)i, stacks[i] + STACK) < 0){
+      printf("futexbench: clone failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < NWORKER; i++)
+    join(-1);
+  t1 = uptime_ns();
+  *cpu = 0;
+  for(i = 0; i < NWORKER; i++)
+    *cpu += cputime[i];
+  if(counter != (uint64)NWORKER*iters)
+    printf("futexbench: counter %lu, expected %lu\n", counter, (uint64)NWORKER*iters);
+  return t1 - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 ns, cpu;
+
+  if(argc > 1)
+    iters = atoi(argv[1]);
+
+  for(usefutex = 0; usefutex < 2; usefutex++){
+    ns = run(&cpu);
+    printf("futexbench: %s: %d threads x %d iterations, %lu us, %lu ns/op, %lu us cpu\n",
+           usefutex ? "futex" : "spin", NWORKER, iters, ns / 1000,
+           ns / ((uint64)NWORKER*iters), cpu * NSPERCYCLE / 1000);
+  }
+  exit(0);
+}
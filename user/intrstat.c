@@ -0,0 +1,80 @@
+// Report interrupts taken per second by each hart,
+// first with the system idle and then with one spinning
+// process per hart.
+//
+//   intrstat [ticks]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define TICKSPERSEC (TIMEFREQ / TICKCYCLES)
+
+struct sysinfo before, after;
+
+// print per-second rates for the interval between before and after.
+void
+report(char *what)
+{
+  uint dt = after.ticks - before.ticks;
+  uint64 timer, dev, ipi, total;
+  int i;
+
+  if(dt == 0)
+    dt = 1;
+  total = 0;
+  printf("%s: %d ticks\n", what, dt);
+  for(i = 0; i < NCPU; i++){
+    if(after.ntimer[i] == 0)
+      continue;  // hart never started
+    timer = (after.ntimer[i] - before.ntimer[i]) * TICKSPERSEC / dt;
+    dev = (after.ndevintr[i] - before.ndevintr[i]) * TICKSPERSEC / dt;
+    ipi = (after.nipi[i] - before.nipi[i]) * TICKSPERSEC / dt;
+    printf("  hart %d: %lu timer/s, %lu device/s, %lu ipi/s\n", i, timer, dev, ipi);
+    total += timer + dev + ipi;
+  }
+  printf("  total: %lu interrupts/s\n", total);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int duration = 50;
+  int i, nhart, pid, end;
+
+  if(argc > 1)
+    duration = atoi(argv[1]);
+
+  // idle: this process sleeps, nothing else runs.
+  sysinfo(&before);
+  sleep(duration);
+  sysinfo(&after);
+  report("idle");
+
+  // loaded: one spinner per hart that has started.
+  nhart = 0;
+  for(i = 0; i < NCPU; i++)
+    if(after.ntimer[i] != 0)
+      nhart++;
+  end = uptime() + duration;
+  for(i = 0; i < nhart; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("intrstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      while(uptime() < end)
+        ;
+      exit(0);
+    }
+  }
+  sysinfo(&before);
+  for(i = 0; i < nhart; i++)
+    wait(0);
+  sysinfo(&after);
+  report("loaded");
+
+  exit(0);
+}
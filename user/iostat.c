@@ -0,0 +1,122 @@
+// Report disk I/O statistics: how many requests and blocks
+// went to the disk, how many blocks the I/O scheduler merged
+// into other blocks' requests, and histograms of the queue
+// depth and of latency, for each class of request and each
+// way of noticing completion. With a command, run it and
+// report only what happened while it ran; otherwise report
+// the totals since boot. -r and -w set how many microseconds
+// waits for reads and for writes poll the disk before they
+// sleep; 0 turns polling off.
+//
+//   iostat [-r us] [-w us] [command [args...]]
+
+#include "kernel/types.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+struct iostat before, after;
+
+char *classname[NIOCLASS] = {
+[IOC_READ]  "read",
+[IOC_WRITE] "write",
+[IOC_ASYNC] "async read",
+};
+
+char *modename[NIOMODE] = {
+[IOM_INTR] "interrupt",
+[IOM_POLL] "polled",
+};
+
+void
+subtract(void)
+{
+  int i, w, m, c;
+
+  for(w = 0; w < 2; w++){
+    after.nreq[w] -= before.nreq[w];
+    after.nblock[w] -= before.nblock[w];
+  }
+  for(m = 0; m < NIOMODE; m++)
+    for(c = 0; c < NIOCLASS; c++)
+      for(i = 0; i < NIOHIST; i++)
+        after.lat[m][c][i] -= before.lat[m][c][i];
+  after.nmerge -= before.nmerge;
+  after.nintr -= before.nintr;
+  after.nidle -= before.nidle;
+  after.nkick -= before.nkick;
+  for(i = 0; i < NIOHIST; i++)
+    after.depth[i] -= before.depth[i];
+}
+
+// print the non-empty buckets of h, if any, each labelled
+// with the smallest value it counts.
+void
+histogram(char *what, char *how, uint64 *h)
+{
+  int i;
+
+  for(i = 0; i < NIOHIST; i++)
+    if(h[i] != 0)
+      break;
+  if(i == NIOHIST)
+    return;
+  printf("%s%s%s:", what, how[0] ? ", " : "", how);
+  for(i = 0; i < NIOHIST; i++)
+    if(h[i] != 0)
+      printf(" %d:%lu", i == 0 ? 0 : 1 << i, h[i]);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid, m, c;
+
+  while(argc > 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-r") == 0)
+      iopoll(IOC_READ, atoi(argv[2]));
+    else if(strcmp(argv[1], "-w") == 0)
+      iopoll(IOC_WRITE, atoi(argv[2]));
+    else {
+      printf("usage: iostat [-r us] [-w us] [command [args...]]\n");
+      exit(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
+  if(argc > 1){
+    if(iostat(&before) < 0){
+      printf("iostat: iostat failed\n");
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("iostat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf("iostat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  if(iostat(&after) < 0){
+    printf("iostat: iostat failed\n");
+    exit(1);
+  }
+  subtract();
+
+  printf("reads: %lu requests, %lu blocks\n", after.nreq[0], after.nblock[0]);
+  printf("writes: %lu requests, %lu blocks\n", after.nreq[1], after.nblock[1]);
+  printf("merged: %lu blocks\n", after.nmerge);
+  printf("interrupts: %lu, %lu with nothing to do; notifies: %lu\n",
+         after.nintr, after.nidle, after.nkick);
+  histogram("queue depth", "", after.depth);
+  printf("latency in us:\n");
+  for(c = 0; c < NIOCLASS; c++)
+    for(m = 0; m < NIOMODE; m++)
+      histogram(classname[c], modename[m], after.lat[m][c]);
+  exit(0);
+}
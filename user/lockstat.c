@@ -0,0 +1,161 @@
+// Report lock contention: the most contended spinlocks,
+// summed over the locks that share a name, and the kernel
+// call sites that waited longest for a lock. With a command,
+// run it and report only what happened while it ran;
+// otherwise report the totals since boot. Look the call
+// site addresses up in kernel/kernel.asm.
+//
+//   lockstat [command [args...]]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NTOP 10
+
+struct lockstat raw[NLOCK];
+struct lockstat before[NLOCK], after[NLOCK];
+int nbefore, nafter;
+
+struct locksite sbefore[NSITE], safter[NSITE];
+int nsbefore, nsafter;
+
+// read the kernel's statistics into sum[], one entry per
+// lock name. Returns the number of entries.
+int
+collect(struct lockstat *sum)
+{
+  int i, j, n, k;
+
+  if((n = lockstat(raw, NLOCK)) < 0){
+    printf("lockstat: lockstat failed\n");
+    exit(1);
+  }
+  k = 0;
+  for(i = 0; i < n; i++){
+    for(j = 0; j < k; j++)
+      if(strcmp(sum[j].name, raw[i].name) == 0)
+        break;
+    if(j == k){
+      sum[k] = raw[i];
+      k++;
+      continue;
+    }
+    sum[j].nacquire += raw[i].nacquire;
+    sum[j].ncontend += raw[i].ncontend;
+    sum[j].nspin += raw[i].nspin;
+    sum[j].wait += raw[i].wait;
+  }
+  return k;
+}
+
+int
+collectsites(struct locksite *site)
+{
+  int n;
+
+  if((n = locksites(site, NSITE)) < 0){
+    printf("lockstat: locksites failed\n");
+    exit(1);
+  }
+  return n;
+}
+
+// subtract the matching entries of before from after.
+void
+subtract(void)
+{
+  int i, j;
+
+  for(i = 0; i < nafter; i++){
+    for(j = 0; j < nbefore; j++){
+      if(strcmp(after[i].name, before[j].name) == 0){
+        after[i].nacquire -= before[j].nacquire;
+        after[i].ncontend -= before[j].ncontend;
+        after[i].nspin -= before[j].nspin;
+        after[i].wait -= before[j].wait;
+        break;
+      }
+    }
+  }
+  for(i = 0; i < nsafter; i++){
+    for(j = 0; j < nsbefore; j++){
+      if(safter[i].pc == sbefore[j].pc && strcmp(safter[i].name, sbefore[j].name) == 0){
+        safter[i].ncontend -= sbefore[j].ncontend;
+        safter[i].wait -= sbefore[j].wait;
+        break;
+      }
+    }
+  }
+}
+
+uint64
+us(uint64 cycles)
+{
+  return cycles * NSPERCYCLE / 1000;
+}
+
+void
+report(void)
+{
+  struct lockstat t;
+  struct locksite ts;
+  int i, j;
+
+  // insertion sorts, longest wait first.
+  for(i = 1; i < nafter; i++){
+    t = after[i];
+    for(j = i; j > 0 && after[j-1].wait < t.wait; j--)
+      after[j] = after[j-1];
+    after[j] = t;
+  }
+  for(i = 1; i < nsafter; i++){
+    ts = safter[i];
+    for(j = i; j > 0 && safter[j-1].wait < ts.wait; j--)
+      safter[j] = safter[j-1];
+    safter[j] = ts;
+  }
+
+  printf("lock acquire contend spin wait-us\n");
+  for(i = 0; i < nafter && i < NTOP; i++){
+    if(after[i].nacquire == 0)
+      continue;
+    printf("%s %lu %lu %lu %lu\n", after[i].name, after[i].nacquire,
+           after[i].ncontend, after[i].nspin, us(after[i].wait));
+  }
+  printf("\ncall-site lock contend wait-us\n");
+  for(i = 0; i < nsafter && i < NTOP; i++){
+    if(safter[i].ncontend == 0)
+      continue;
+    printf("%p %s%s %lu %lu\n", (void *)safter[i].pc, safter[i].name,
+           safter[i].sleep ? " (sleep)" : "", safter[i].ncontend, us(safter[i].wait));
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid;
+
+  if(argc > 1){
+    nbefore = collect(before);
+    nsbefore = collectsites(sbefore);
+    pid = fork();
+    if(pid < 0){
+      printf("lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf("lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  nafter = collect(after);
+  nsafter = collectsites(safter);
+  subtract();
+  report();
+  exit(0);
+}
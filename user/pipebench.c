@@ -0,0 +1,92 @@
+// Measure pipe ping-pong latency.
+// A parent and a child bounce one byte back and forth over a
+// pair of pipes, so every round trip costs two sleep()/wakeup()
+// pairs. Optionally park extra processes in sleep() first, to
+// show how wakeup() cost depends on the number of sleepers.
+//
+//   pipebench [rounds [sleepers]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define ROUNDS 10000
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = ROUNDS, sleepers = 0;
+  int ping[2], pong[2], park[2];
+  int i, pid, t0, t1;
+  char c = 'x';
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    sleepers = atoi(argv[2]);
+
+  // processes blocked reading a pipe that is never written.
+  if(pipe(park) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < sleepers; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("pipebench: fork failed after %d sleepers\n", i);
+      sleepers = i;
+      break;
+    }
+    if(pid == 0){
+      close(park[1]);
+      read(park[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(park[0]);
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        break;
+      if(write(pong[1], &c, 1) != 1)
+        break;
+    }
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  t0 = uptime();
+  for(i = 0; i < rounds; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      printf("pipebench: round %d failed\n", i);
+      break;
+    }
+  }
+  t1 = uptime();
+  wait(0);
+
+  // release the parked sleepers.
+  close(park[1]);
+  for(i = 0; i < sleepers; i++)
+    wait(0);
+
+  printf("pipebench: %d round trips, %d sleepers, %d ticks\n",
+         rounds, sleepers, t1 - t0);
+  if(t1 > t0)
+    printf("pipebench: %d round trips/tick\n", rounds / (t1 - t0));
+  exit(0);
+}
@@ -0,0 +1,129 @@
+// Scheduler throughput benchmark.
+// Runs NCPUBOUND processes that spin and NIOBOUND processes
+// that bounce a byte through pipes in pairs, all for the same
+// number of ticks, then reports how much work each class got
+// done. The I/O-bound pairs sleep and wake constantly, so
+// their count reflects how quickly the scheduler finds and
+// dispatches newly RUNNABLE processes while the spinners
+// keep every hart busy.
+//
+//   schedbench [ticks]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NCPUBOUND 8
+#define NIOBOUND  32
+#define TICKS     50
+
+struct report {
+  int cpubound;
+  uint64 count;
+};
+
+int
+main(int argc, char *argv[])
+{
+  int duration = TICKS;
+  int results[2], ping[2], pong[2];
+  int i, pid, start, n;
+  uint64 count, cputotal, iototal;
+  struct report r;
+  char c = 'x';
+
+  if(argc > 1)
+    duration = atoi(argv[1]);
+
+  if(pipe(results) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+
+  // everyone starts counting from the same tick.
+  start = uptime() + 1;
+
+  for(i = 0; i < NCPUBOUND; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(results[0]);
+      while(uptime() < start)
+        ;
+      for(count = 0; uptime() < start + duration; count++)
+        ;
+      r.cpubound = 1;
+      r.count = count;
+      write(results[1], &r, sizeof(r));
+      exit(0);
+    }
+  }
+
+  for(i = 0; i < NIOBOUND; i += 2){
+    if(pipe(ping) < 0 || pipe(pong) < 0){
+      printf("schedbench: pipe failed\n");
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // the echoing half of the pair.
+      close(results[0]);
+      close(ping[1]);
+      close(pong[0]);
+      while(read(ping[0], &c, 1) == 1)
+        write(pong[1], &c, 1);
+      exit(0);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(results[0]);
+      close(ping[0]);
+      close(pong[1]);
+      while(uptime() < start)
+        sleep(1);
+      for(count = 0; uptime() < start + duration; count++){
+        if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+          break;
+      }
+      close(ping[1]);
+      r.cpubound = 0;
+      r.count = count;
+      write(results[1], &r, sizeof(r));
+      exit(0);
+    }
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+  }
+  close(results[1]);
+
+  cputotal = iototal = 0;
+  n = 0;
+  while(read(results[0], &r, sizeof(r)) == sizeof(r)){
+    if(r.cpubound)
+      cputotal += r.count;
+    else
+      iototal += r.count;
+    n++;
+  }
+  for(i = 0; i < NCPUBOUND + NIOBOUND; i++)
+    wait(0);
+
+  printf("schedbench: %d cpu-bound, %d io-bound, %d ticks\n",
+         NCPUBOUND, NIOBOUND, duration);
+  printf("schedbench: %d reports, cpu-bound loops %lu, io round trips %lu\n",
+         n, cputotal, iototal);
+  exit(0);
+}
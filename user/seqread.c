@@ -0,0 +1,76 @@
+// Sequential read benchmark. Writes a large file, drops the
+// buffer cache, and reads the file back the way cat does,
+// first from the disk and then from the cache. Reports the
+// throughput and how many blocks were read ahead.
+//
+//   seqread [blocks]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NBLK 200
+
+char buf[512];
+
+void
+readfile(char *name, char *what)
+{
+  struct sysinfo before, after;
+  uint64 t0, ns, bytes;
+  int fd, n;
+
+  sysinfo(&before);
+  t0 = uptime_ns();
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf("seqread: open %s failed\n", name);
+    exit(1);
+  }
+  bytes = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    bytes += n;
+  close(fd);
+  ns = uptime_ns() - t0;
+  sysinfo(&after);
+
+  if(ns == 0)
+    ns = 1;
+  printf("seqread: %s: %lu KB in %lu us, %lu KB/s, %lu misses, %lu read ahead\n",
+         what, bytes / 1024, ns / 1000, bytes * 1000000 / ns,
+         after.bmiss - before.bmiss, after.bra - before.bra);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *name = "seqread.tmp";
+  int i, fd, nblk = NBLK;
+
+  if(argc > 1)
+    nblk = atoi(argv[1]);
+  if(nblk > MAXFILE)
+    nblk = MAXFILE;
+
+  if((fd = open(name, O_CREATE | O_TRUNC | O_WRONLY)) < 0){
+    printf("seqread: create %s failed\n", name);
+    exit(1);
+  }
+  memset(buf, 's', sizeof(buf));
+  for(i = 0; i < nblk * (BSIZE / sizeof(buf)); i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("seqread: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  dropcache();
+  readfile(name, "cold");
+  readfile(name, "cached");
+
+  unlink(name);
+  exit(0);
+}
@@ -1,4 +1,9 @@
 struct stat;
+struct pstat;
+struct sysinfo;
+struct lockstat;
+struct iostat;
+struct locksite;
 
 // system calls
 int fork(void);
@@ -22,6 +27,23 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int setpriority(int, int);
+int getpstat(int, struct pstat*);
+int sysinfo(struct sysinfo*);
+int nanosleep(uint64);
+uint64 uptime_ns(void);
+int setaffinity(int, int);
+int clone(void(*)(void*), void*, void*);
+int join(int);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int waitpid(int, int*, int);
+int lockstat(struct lockstat*, int);
+int locksites(struct locksite*, int);
+int dropcache(void);
+int iostat(struct iostat*);
+int iopoll(int, int);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
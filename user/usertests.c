@@ -7,6 +7,11 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/pstat.h"
+#include "kernel/wait.h"
+#include "kernel/lockstat.h"
+#include "kernel/sysinfo.h"
+#include "kernel/iostat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -818,6 +823,849 @@ killstatus(char *s)
   exit(0);
 }
 
+// setpriority() changes the base level, and getpstat()
+// reports it along with the time spent running.
+void
+setpriotest(char *s)
+{
+  struct pstat st;
+  int old;
+
+  if((old = setpriority(getpid(), NPRIO-1)) < 0){
+    printf("%s: setpriority failed\n", s);
+    exit(1);
+  }
+  if(setpriority(getpid(), NPRIO) != -1 || setpriority(getpid(), -1) != -1){
+    printf("%s: setpriority accepted a bad level\n", s);
+    exit(1);
+  }
+  if(getpstat(getpid(), &st) < 0){
+    printf("%s: getpstat failed\n", s);
+    exit(1);
+  }
+  if(st.pid != getpid() || st.basepri != NPRIO-1 || st.priority != NPRIO-1){
+    printf("%s: getpstat returned wrong levels\n", s);
+    exit(1);
+  }
+  if(st.rtime == 0 || st.nsched == 0){
+    printf("%s: getpstat did not count running time\n", s);
+    exit(1);
+  }
+  if(getpstat(-1, &st) != -1 || getpstat(getpid(), (struct pstat *)0xffffffffffL) != -1){
+    printf("%s: getpstat accepted bad arguments\n", s);
+    exit(1);
+  }
+  if(setpriority(getpid(), old) != NPRIO-1){
+    printf("%s: setpriority did not return the old level\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+void
+nanosleeptest(char *s)
+{
+  static uint64 durations[] = { 0, 1000, 50000, 2000000, 30000000 };
+  uint64 t0, t1;
+  int i, pid, xstatus;
+
+  for(i = 0; i < sizeof(durations)/sizeof(durations[0]); i++){
+    t0 = uptime_ns();
+    if(nanosleep(durations[i]) < 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+    t1 = uptime_ns();
+    if(t1 < t0 || t1 - t0 < durations[i]){
+      printf("%s: nanosleep(%lu) returned after %lu ns\n", s, durations[i], t1 - t0);
+      exit(1);
+    }
+  }
+
+  // a long sleep must not delay kill().
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nanosleep(1000000000000L);
+    exit(0);
+  }
+  nanosleep(10000000);
+  kill(pid);
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: killed sleeper exited with %d\n", s, xstatus);
+    exit(1);
+  }
+  exit(0);
+}
+
+void
+affinitytest(char *s)
+{
+  struct pstat st;
+  uint64 nmigrate;
+  int i, pid, xstatus;
+
+  if(setaffinity(getpid(), 0) != -1){
+    printf("%s: setaffinity accepted an empty mask\n", s);
+    exit(1);
+  }
+  if(setaffinity(getpid(), 1) < 0){
+    printf("%s: setaffinity failed\n", s);
+    exit(1);
+  }
+  // setaffinity() moves the caller right away.
+  if(getpstat(getpid(), &st) < 0 || st.cpumask != 1 || st.lastcpu != 0){
+    printf("%s: not running on cpu 0\n", s);
+    exit(1);
+  }
+  nmigrate = st.nmigrate;
+  for(i = 0; i < 20; i++)
+    nanosleep(100000);
+  if(getpstat(getpid(), &st) < 0 || st.lastcpu != 0 || st.nmigrate != nmigrate){
+    printf("%s: pinned process migrated\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(getpstat(getpid(), &st) < 0 || st.cpumask != 1 || st.lastcpu != 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit the mask\n", s);
+    exit(1);
+  }
+  if(setaffinity(getpid(), -1) != 1){
+    printf("%s: setaffinity did not return the old mask\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+#define NCLONE 4
+
+volatile int clonecounter;
+volatile char clonepage[2*PGSIZE];
+char clonestacks[NCLONE][PGSIZE];
+
+void
+clonechild(void *arg)
+{
+  int i, id = (int)(uint64)arg;
+
+  // all threads write the same page, which fork() has
+  // just made copy-on-write.
+  for(i = 0; i < 1000; i++){
+    __sync_fetch_and_add(&clonecounter, 1);
+    clonepage[PGSIZE + id] = id + 1;
+  }
+  exit(0);
+}
+
+void
+cloneforker(void *arg)
+{
+  int pid;
+
+  pid = fork();
+  if(pid == 0)
+    exit(5);
+  exit(pid < 0);
+}
+
+void
+clonespin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+void
+clonetest(char *s)
+{
+  int i, pid, tid, tids[NCLONE], xstatus;
+
+  // make the data pages copy-on-write before the
+  // threads start writing them.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(5);
+    exit(0);
+  }
+
+  for(i = 0; i < NCLONE; i++){
+    tids[i] = clone(clonechild, (void *)(uint64)i, clonestacks[i] + PGSIZE);
+    if(tids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++){
+    if((tid = join(tids[i])) != tids[i]){
+      printf("%s: join returned %d, not %d\n", s, tid, tids[i]);
+      exit(1);
+    }
+  }
+  if(join(-1) != -1){
+    printf("%s: join with no threads did not fail\n", s);
+    exit(1);
+  }
+  if(clonecounter != NCLONE*1000){
+    printf("%s: counter %d, not %d\n", s, clonecounter, NCLONE*1000);
+    exit(1);
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(clonepage[PGSIZE + i] != i + 1){
+      printf("%s: thread %d's store was lost\n", s, i);
+      exit(1);
+    }
+  }
+  // threads are not children.
+  wait(&xstatus);
+  if(xstatus != 0 || wait(0) != -1){
+    printf("%s: wait saw a thread\n", s);
+    exit(1);
+  }
+
+  // a child forked by a thread is the process's child.
+  tid = clone(cloneforker, 0, clonestacks[0] + PGSIZE);
+  if(tid < 0 || join(tid) != tid){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) < 0 || xstatus != 5){
+    printf("%s: wait missed a child forked by a thread\n", s);
+    exit(1);
+  }
+
+  // exit() must take down threads that never return.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < NCLONE; i++)
+      clone(clonespin, 0, clonestacks[i] + PGSIZE);
+    sleep(1);
+    exit(7);
+  }
+  wait(&xstatus);
+  if(xstatus != 7){
+    printf("%s: process with threads exited with %d\n", s, xstatus);
+    exit(1);
+  }
+  exit(0);
+}
+
+volatile int cowracedone;
+volatile char *cowracetop;
+int cowracefd;
+
+// write the data pages, which fork() keeps making COW, and
+// have the kernel write the pages that sbrk() keeps
+// removing; fstat() fails if they are gone.
+void
+cowracechild(void *arg)
+{
+  int id = (int)(uint64)arg;
+  char *top;
+
+  while(!cowracedone){
+    clonepage[id] = id;
+    top = (char *)cowracetop;
+    fstat(cowracefd, (struct stat *)(top + id * PGSIZE));
+  }
+  exit(0);
+}
+
+// threads fault on COW pages while another thread shrinks
+// the process and forks.
+void
+cowracetest(char *s)
+{
+  enum { NPG = NCLONE, ROUNDS = 100 };
+  int i, fds[2], pid, tids[NCLONE];
+  char *top;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  cowracefd = fds[0];
+  cowracetop = sbrk(0);
+  for(i = 0; i < NCLONE; i++){
+    tids[i] = clone(cowracechild, (void *)(uint64)i, clonestacks[i] + PGSIZE);
+    if(tids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < ROUNDS; i++){
+    if((top = sbrk(NPG * PGSIZE)) == (char *)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    cowracetop = top;
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    sbrk(-NPG * PGSIZE);
+    wait(0);
+  }
+  cowracedone = 1;
+  for(i = 0; i < NCLONE; i++)
+    join(tids[i]);
+  close(fds[0]);
+  close(fds[1]);
+  exit(0);
+}
+
+void
+waitpidtest(char *s)
+{
+  int i, pids[3], pid, xstatus;
+
+  for(i = 0; i < 3; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pids[i] == 0){
+      // the first child exits last.
+      sleep(i == 0 ? 5 : 0);
+      exit(10 + i);
+    }
+  }
+
+  if(waitpid(pids[0], &xstatus, WNOHANG) != 0){
+    printf("%s: WNOHANG did not return 0 for a running child\n", s);
+    exit(1);
+  }
+  if(waitpid(getpid(), 0, WNOHANG) != -1){
+    printf("%s: waitpid accepted a pid that is not a child\n", s);
+    exit(1);
+  }
+  // reap out of order.
+  for(i = 2; i >= 0; i--){
+    pid = waitpid(pids[i], &xstatus, 0);
+    if(pid != pids[i] || xstatus != 10 + i){
+      printf("%s: waitpid(%d) returned %d, status %d\n", s, pids[i], pid, xstatus);
+      exit(1);
+    }
+  }
+  if(waitpid(-1, 0, WNOHANG) != -1 || wait(0) != -1){
+    printf("%s: reaped child still visible\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+struct lockstat lockstats[NLOCK];
+struct locksite locksitebuf[NSITE];
+
+// count the tracked locks called name, and check that
+// every lock reported has been acquired.
+int
+countlocks(char *s, char *name)
+{
+  int i, n, count;
+
+  if((n = lockstat(lockstats, NLOCK)) <= 0){
+    printf("%s: lockstat returned %d\n", s, n);
+    exit(1);
+  }
+  count = 0;
+  for(i = 0; i < n; i++){
+    if(lockstats[i].nacquire == 0 || lockstats[i].ncontend > lockstats[i].nacquire){
+      printf("%s: bad counts for %s\n", s, lockstats[i].name);
+      exit(1);
+    }
+    if(strcmp(lockstats[i].name, name) == 0)
+      count++;
+  }
+  return count;
+}
+
+void
+lockstattest(char *s)
+{
+  int i, n, before, after, fds[2];
+
+  if(countlocks(s, "kmem") == 0){
+    printf("%s: kmem lock not reported\n", s);
+    exit(1);
+  }
+  // a freed pipe's lock must leave the table.
+  before = countlocks(s, "pipe");
+  for(i = 0; i < 20; i++){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    write(fds[1], "x", 1);
+    close(fds[0]);
+    close(fds[1]);
+  }
+  after = countlocks(s, "pipe");
+  if(after > before + 1){
+    printf("%s: %d pipe locks before, %d after\n", s, before, after);
+    exit(1);
+  }
+  if(lockstat(lockstats, 0) != 0){
+    printf("%s: lockstat with n=0 did not return 0\n", s);
+    exit(1);
+  }
+  n = locksites(locksitebuf, NSITE);
+  if(n < 0){
+    printf("%s: locksites failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(locksitebuf[i].pc == 0 || locksitebuf[i].ncontend == 0){
+      printf("%s: bad call site for %s\n", s, locksitebuf[i].name);
+      exit(1);
+    }
+  }
+}
+
+// concurrent lookups through a shared directory, which
+// take its inode lock shared, while other processes create
+// and unlink files in it.
+void
+sharedlookuptest(char *s)
+{
+  enum { NCHILD = 4, N = 50 };
+  char name[] = "lookupdir/f0";
+  int i, j, fd, pid, xstatus;
+  struct stat st;
+
+  unlink("lookupdir");
+  if(mkdir("lookupdir") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[11] = '0' + i;
+      for(j = 0; j < N; j++){
+        if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+        close(fd);
+        if(stat(name, &st) < 0 || st.type != T_FILE){
+          printf("%s: stat %s failed\n", s, name);
+          exit(1);
+        }
+        if(stat("lookupdir/../lookupdir", &st) < 0 || st.type != T_DIR){
+          printf("%s: stat lookupdir failed\n", s);
+          exit(1);
+        }
+        if(unlink(name) < 0){
+          printf("%s: unlink %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  if(unlink("lookupdir") < 0){
+    printf("%s: unlink lookupdir failed\n", s);
+    exit(1);
+  }
+}
+
+// the buffer cache grows past NBUF to hold a file bigger
+// than that, and reading the file again hits.
+void
+bcachegrowtest(char *s)
+{
+  enum { NBLK = NBUF + 10 };
+  static char buf[BSIZE];
+  struct sysinfo before, after;
+  int i, fd;
+
+  if((fd = open("bcachegrow", O_CREATE | O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    buf[0] = i;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  sysinfo(&before);
+  if((fd = open("bcachegrow", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != (char)i){
+      printf("%s: read of block %d failed\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  sysinfo(&after);
+  unlink("bcachegrow");
+
+  if(after.nbuf <= NBUF || after.nbuf > after.maxbuf){
+    printf("%s: %d buffers, limit %d\n", s, after.nbuf, after.maxbuf);
+    exit(1);
+  }
+  if(after.bhit - before.bhit < NBLK){
+    printf("%s: only %lu hits re-reading the file\n", s, after.bhit - before.bhit);
+    exit(1);
+  }
+}
+
+// reading a file sequentially from a cold cache reads
+// ahead, and the data read ahead is right.
+void
+readaheadtest(char *s)
+{
+  enum { NBLK = 40 };
+  static char buf[BSIZE];
+  struct sysinfo before, after;
+  int i, j, fd;
+
+  if((fd = open("readahead", O_CREATE | O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  dropcache();
+  sysinfo(&before);
+  if((fd = open("readahead", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  // half blocks, as cat reads.
+  for(i = 0; i < 2*NBLK; i++){
+    if(read(fd, buf, BSIZE/2) != BSIZE/2){
+      printf("%s: read %d failed\n", s, i);
+      exit(1);
+    }
+    for(j = 0; j < BSIZE/2; j++){
+      if(buf[j] != (char)(i/2)){
+        printf("%s: wrong data in block %d\n", s, i/2);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  sysinfo(&after);
+  unlink("readahead");
+
+  if(after.bra == before.bra){
+    printf("%s: nothing was read ahead\n", s);
+    exit(1);
+  }
+}
+
+// writing a file goes through the I/O scheduler, which
+// merges the consecutive blocks of each log commit, and
+// times every block it writes.
+void
+iostattest(char *s)
+{
+  enum { NBLK = 10 };
+  static char buf[BSIZE];
+  static struct iostat before, after;
+  uint64 nlat;
+  int i, fd;
+
+  if(iostat(&before) < 0){
+    printf("%s: iostat failed\n", s);
+    exit(1);
+  }
+  if((fd = open("iostat", O_CREATE | O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'i', sizeof(buf));
+  for(i = 0; i < NBLK; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  fsync(fd);
+  iostat(&after);
+  close(fd);
+  unlink("iostat");
+
+  if(after.nblock[1] - before.nblock[1] < NBLK){
+    printf("%s: only %lu blocks written\n", s, after.nblock[1] - before.nblock[1]);
+    exit(1);
+  }
+  if(after.nmerge == before.nmerge){
+    printf("%s: no blocks were merged\n", s);
+    exit(1);
+  }
+  if(after.nintr == before.nintr || after.nkick == before.nkick){
+    printf("%s: disk interrupts or notifies not counted\n", s);
+    exit(1);
+  }
+  if(after.nintr - before.nintr > after.nreq[1] - before.nreq[1] + after.nreq[0] - before.nreq[0]){
+    printf("%s: more interrupts than requests\n", s);
+    exit(1);
+  }
+  nlat = 0;
+  for(i = 0; i < NIOHIST; i++)
+    nlat += after.lat[IOM_INTR][IOC_WRITE][i] - before.lat[IOM_INTR][IOC_WRITE][i] +
+            after.lat[IOM_POLL][IOC_WRITE][i] - before.lat[IOM_POLL][IOC_WRITE][i];
+  if(nlat != after.nblock[1] - before.nblock[1]){
+    printf("%s: %lu blocks written but %lu timed\n", s,
+           after.nblock[1] - before.nblock[1], nlat);
+    exit(1);
+  }
+}
+
+// with polling on for reads, a read from a cold cache
+// notices its completion by polling.
+void
+iopolltest(char *s)
+{
+  static char buf[BSIZE];
+  static struct iostat before, after;
+  uint64 npoll;
+  int i, fd, old;
+
+  if((fd = open("iopoll", O_CREATE | O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(iopoll(IOC_ASYNC, 1) != -1){
+    printf("%s: read-ahead can poll\n", s);
+    exit(1);
+  }
+  dropcache();
+  old = iopoll(IOC_READ, 100000);
+  iostat(&before);
+  if((fd = open("iopoll", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  read(fd, buf, sizeof(buf));
+  close(fd);
+  iostat(&after);
+  iopoll(IOC_READ, old);
+  unlink("iopoll");
+
+  npoll = 0;
+  for(i = 0; i < NIOHIST; i++)
+    npoll += after.lat[IOM_POLL][IOC_READ][i] - before.lat[IOM_POLL][IOC_READ][i];
+  if(npoll == 0){
+    printf("%s: no read was polled\n", s);
+    exit(1);
+  }
+}
+
+// a write returns before its transaction commits; fsync()
+// waits for the log and the installed blocks to be written.
+void
+fsynctest(char *s)
+{
+  static char buf[BSIZE];
+  static struct iostat before, after;
+  int fd;
+
+  if((fd = open("fsync", O_CREATE | O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fsync(fd);
+  iostat(&before);
+  memset(buf, 'f', sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  iostat(&after);
+  close(fd);
+  unlink("fsync");
+
+  // the data block, and the inode, logged and then installed.
+  if(after.nblock[1] - before.nblock[1] < 3){
+    printf("%s: fsync wrote only %lu blocks\n", s, after.nblock[1] - before.nblock[1]);
+    exit(1);
+  }
+  if(fsync(-1) != -1 || fsync(100) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+// in ordered mode, file data is written once, in place,
+// rather than to the log and then home.
+void
+orderedtest(char *s)
+{
+  enum { NBLK = 64 };
+  static char buf[BSIZE];
+  static struct iostat before, after;
+  uint64 n;
+  int i, fd;
+
+  if((fd = open("ordered", O_CREATE | O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fsync(fd);
+  iostat(&before);
+  memset(buf, 'o', sizeof(buf));
+  for(i = 0; i < NBLK; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  fsync(fd);
+  iostat(&after);
+  close(fd);
+
+  n = after.nblock[1] - before.nblock[1];
+  if(n < NBLK){
+    printf("%s: only %lu blocks written\n", s, n);
+    exit(1);
+  }
+#ifndef JOURNAL_DATA
+  if(n >= NBLK + NBLK/2){
+    printf("%s: %lu blocks written for %d of data\n", s, n, NBLK);
+    exit(1);
+  }
+#endif
+
+  // the data reads back after the cache is dropped.
+  dropcache();
+  if((fd = open("ordered", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'o' || buf[BSIZE-1] != 'o'){
+      printf("%s: read back wrong data\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("ordered");
+}
+
+// balloc() allocates a file's blocks one after another, without
+// scanning the bitmap from the start.
+void
+balloctest(char *s)
+{
+  enum { NBLK = 20 };
+  static char buf[BSIZE];
+  struct sysinfo before, after;
+  uint64 nalloc;
+  int i, fd;
+
+  if((fd = open("balloc", O_CREATE | O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  sysinfo(&before);
+  memset(buf, 'b', sizeof(buf));
+  for(i = 0; i < NBLK; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  if(write(fd, buf, 10) != 10){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  sysinfo(&after);
+  close(fd);
+
+  nalloc = after.balloc - before.balloc;
+  if(nalloc < NBLK + 1){
+    printf("%s: only %lu blocks allocated\n", s, nalloc);
+    exit(1);
+  }
+  if(after.bscan - before.bscan > 8 * nalloc){
+    printf("%s: %lu bits scanned for %lu blocks\n", s,
+           after.bscan - before.bscan, nalloc);
+    exit(1);
+  }
+
+  // the blocks that weren't zeroed read back from the disk.
+  dropcache();
+  if((fd = open("balloc", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'b' || buf[BSIZE-1] != 'b'){
+      printf("%s: read back wrong data\n", s);
+      exit(1);
+    }
+  }
+  if(read(fd, buf, sizeof(buf)) != 10 || buf[9] != 'b'){
+    printf("%s: last block read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("balloc");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -2610,6 +3458,21 @@ struct test {
   {exectest, "exectest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
+  {setpriotest, "setpriotest"},
+  {nanosleeptest, "nanosleeptest"},
+  {affinitytest, "affinitytest"},
+  {clonetest, "clonetest"},
+  {cowracetest, "cowracetest"},
+  {waitpidtest, "waitpidtest"},
+  {lockstattest, "lockstattest"},
+  {sharedlookuptest, "sharedlookuptest"},
+  {bcachegrowtest, "bcachegrowtest"},
+  {readaheadtest, "readaheadtest"},
+  {iostattest, "iostattest"},
+  {iopolltest, "iopolltest"},
+  {fsynctest, "fsynctest"},
+  {orderedtest, "orderedtest"},
+  {balloctest, "balloctest"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
   {reparent, "reparent" },
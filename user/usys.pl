@@ -36,3 +36,20 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("setpriority");
+entry("getpstat");
+entry("sysinfo");
+entry("nanosleep");
+entry("uptime_ns");
+entry("setaffinity");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("waitpid");
+entry("lockstat");
+entry("locksites");
+entry("dropcache");
+entry("iostat");
+entry("iopoll");
+entry("fsync");